@@ -0,0 +1,121 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "log.h"
+
+enum {
+    arenaAlign = 16,
+    // Enough for a batch of short queries and a few module buffers.
+    arenaBlockSize = 16 << 10
+};
+
+struct arenaBlock {
+    struct arenaBlock *next;
+    size_t size;
+};
+
+// The block header keeps the allocations aligned.
+static const size_t blockHeader = (sizeof(struct arenaBlock) + arenaAlign - 1) & ~(size_t)(arenaAlign - 1);
+
+static size_t alignUp(size_t size)
+{
+    return (size + arenaAlign - 1) & ~(size_t)(arenaAlign - 1);
+}
+
+void arenaInit(struct arena *arena)
+{
+    memset(arena, 0, sizeof(struct arena));
+}
+
+static int addBlock(struct arena *arena, size_t size)
+{
+    size_t blockSize = blockHeader + size;
+    if (blockSize < arenaBlockSize) {
+        blockSize = arenaBlockSize;
+    }
+    struct arenaBlock *block = (struct arenaBlock *)malloc(blockSize);
+    if (!block) {
+        LOG(LFatal, "Allocation failed (%zu bytes)", blockSize);
+        return 1;
+    }
+    block->size = blockSize;
+    block->next = arena->blocks;
+    arena->blocks = block;
+    // The rest of the previous block is given up.
+    arena->top = (char *)block + blockHeader;
+    arena->left = blockSize - blockHeader;
+    return 0;
+}
+
+void *arenaAlloc(struct arena *arena, size_t size)
+{
+    size = alignUp(size ? size : 1);
+    if (arena->left < size && addBlock(arena, size)) {
+        return NULL;
+    }
+    char *data = arena->top;
+    arena->top += size;
+    arena->left -= size;
+    arena->last = data;
+    return data;
+}
+
+void *arenaGrow(struct arena *arena, void *data, size_t size, size_t grown)
+{
+    if (!data) {
+        return arenaAlloc(arena, grown);
+    }
+    if (grown <= size) {
+        return data;
+    }
+
+    if (data == arena->last) {
+        size_t used = (size_t)(arena->top - arena->last);
+        size_t needed = alignUp(grown);
+        if (needed <= used + arena->left) {
+            arena->top = arena->last + needed;
+            arena->left -= needed - used;
+            return data;
+        }
+    }
+
+    void *moved = arenaAlloc(arena, grown);
+    if (moved) {
+        memcpy(moved, data, size);
+    }
+    return moved;
+}
+
+void arenaReset(struct arena *arena)
+{
+    struct arenaBlock *largest = NULL;
+    while (arena->blocks) {
+        struct arenaBlock *block = arena->blocks;
+        arena->blocks = block->next;
+        if (!largest || block->size > largest->size) {
+            free(largest);
+            largest = block;
+        } else {
+            free(block);
+        }
+    }
+
+    arenaInit(arena);
+    if (largest) {
+        largest->next = NULL;
+        arena->blocks = largest;
+        arena->top = (char *)largest + blockHeader;
+        arena->left = largest->size - blockHeader;
+    }
+}
+
+void arenaClean(struct arena *arena)
+{
+    while (arena->blocks) {
+        struct arenaBlock *block = arena->blocks;
+        arena->blocks = block->next;
+        free(block);
+    }
+    arenaInit(arena);
+}
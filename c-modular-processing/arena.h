@@ -0,0 +1,62 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+struct arenaBlock;
+
+// Bump allocator, everything is released at once by arenaReset.
+// Not synchronized.
+struct arena {
+    struct arenaBlock *blocks;
+    char *top;
+    size_t left;
+    // The last allocation, which may still grow in place.
+    char *last;
+};
+
+/** Initialize an empty arena
+ *
+ *  @param arena The arena.
+ */
+void arenaInit(struct arena *arena);
+
+/** Allocate memory which lives until the next reset
+ *
+ *  @param arena The arena.
+ *  @param size The number of bytes.
+ *  @return the memory aligned for any type or NULL in case
+ *          the allocation fails
+ */
+void *arenaAlloc(struct arena *arena, size_t size);
+
+/** Grow an allocation, the content is kept
+ *
+ *  The last allocation grows in place when its block has room,
+ *  other ones are copied and the old memory is not reused until
+ *  the reset.
+ *
+ *  @param arena The arena.
+ *  @param data The memory from arenaAlloc or arenaGrow.
+ *  @param size The current size of the memory.
+ *  @param grown The new size.
+ *  @return the memory or NULL in case the allocation fails,
+ *          the old memory is unchanged then
+ */
+void *arenaGrow(struct arena *arena, void *data, size_t size, size_t grown);
+
+/** Release all allocations
+ *
+ *  The largest block is kept for the next use.
+ *
+ *  @param arena The arena.
+ */
+void arenaReset(struct arena *arena);
+
+/** Release all memory of the arena.
+ *
+ *  @param arena The arena.
+ */
+void arenaClean(struct arena *arena);
+
+#endif
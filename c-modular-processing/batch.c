@@ -0,0 +1,11 @@
+#include "batch.h"
+
+void *batchAlloc(struct batch *batch, size_t size)
+{
+    return arenaAlloc(&batch->arena, size);
+}
+
+void batchRelease(struct batch *batch)
+{
+    arenaReset(&batch->arena);
+}
@@ -0,0 +1,45 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stddef.h>
+
+#include "arena.h"
+#include "query.h"
+
+struct batch {
+    struct query *queries;
+    size_t count;
+
+    // Queries which do not take part in the current stage, or NULL
+    // in case all of them do.
+    const unsigned char *skip;
+
+    // Memory released together with the batch, see batchAlloc. The
+    // queries allocate their responses from it too.
+    struct arena arena;
+};
+
+static inline int batchSkips(const struct batch *batch, size_t index)
+{
+    return batch->skip && batch->skip[index];
+}
+
+/** Allocate memory which lives until the batch is released
+ *
+ *  Responses stored in such memory need no responseCleanup.
+ *
+ *  @param batch The batch.
+ *  @param size The number of bytes.
+ *  @return the memory or NULL in case the allocation fails
+ */
+void *batchAlloc(struct batch *batch, size_t size);
+
+/** Release all memory allocated by batchAlloc
+ *
+ *  The arena keeps a block for the next batch, arenaClean frees it.
+ *
+ *  @param batch The batch.
+ */
+void batchRelease(struct batch *batch);
+
+#endif
@@ -0,0 +1,89 @@
+// Throughput of the case mapping kernels for short and long queries.
+//
+// Usage: casemap-bench [megabytes per measurement]
+//
+// Prints a line per kernel and query length:
+//   kernel length bytes/cycle ns/call
+// Cycles are the time stamp counter on x86, nanoseconds elsewhere.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "casemap.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC 1
+#endif
+
+static uint64_t nanoseconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + now.tv_nsec;
+}
+
+static uint64_t cycles(void)
+{
+#ifdef HAVE_TSC
+    return __rdtsc();
+#else
+    return nanoseconds();
+#endif
+}
+
+int main(int argc, char **argv)
+{
+    static const char *const names[] = { "scalar", "swar", "sse2", "avx2" };
+    static const size_t lengths[] = { 8, 16, 24, 32, 64, 256, 4096, 1 << 20 };
+    const size_t maxLength = 1 << 20;
+
+    size_t total = (argc > 1 ? strtoul(argv[1], NULL, 10) : 64) << 20;
+    char *in = (char *)malloc(maxLength);
+    char *out = (char *)malloc(maxLength);
+    if (!in || !out || !total) {
+        fprintf(stderr, "usage: %s [megabytes per measurement]\n", argv[0]);
+        return 1;
+    }
+
+    srand(42);
+    for (size_t i = 0; i < maxLength; ++i) {
+        in[i] = ' ' + rand() % 95;
+    }
+
+    printf("kernel length bytes/cycle ns/call\n");
+    for (size_t n = 0; n < sizeof(names) / sizeof(*names); ++n) {
+        if (caseSelect(names[n])) {
+            continue;
+        }
+        for (size_t l = 0; l < sizeof(lengths) / sizeof(*lengths); ++l) {
+            size_t length = lengths[l];
+            size_t calls = total / length;
+            // Queries start at varying offsets, as in a batch.
+            size_t stride = length < 4096 ? length + 7 : 0;
+            size_t offset = 0;
+
+            uint64_t startNs = nanoseconds();
+            uint64_t start = cycles();
+            for (size_t c = 0; c < calls; ++c) {
+                caseToUpper(out + offset, in + offset, length);
+                offset += stride;
+                if (offset + length > maxLength) {
+                    offset = 0;
+                }
+            }
+            uint64_t elapsed = cycles() - start;
+            uint64_t elapsedNs = nanoseconds() - startNs;
+
+            printf("%s %zu %.3f %.2f\n", names[n], length,
+                   (double)calls * length / (elapsed ? elapsed : 1),
+                   (double)elapsedNs / calls);
+        }
+    }
+
+    free(in);
+    free(out);
+    return 0;
+}
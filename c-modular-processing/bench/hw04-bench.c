@@ -0,0 +1,484 @@
+// Micro-benchmarks of the modules, the config and the log, each driven
+// directly without the engine.
+//
+// Usage: hw04-bench [repetitions [benchmark prefix]]
+//
+// Prints a line per benchmark and variant:
+//   benchmark variant bytes ns/op bytes/s
+// bytes is the size of one operation, 0 where an operation copies or
+// scans no data. Every measurement runs once to warm up, the median of
+// the repetitions is reported.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "arena.h"
+#include "clock.h"
+#include "config.h"
+#include "log.h"
+#include "module-cache.h"
+#include "module-decorate.h"
+#include "module-tolower.h"
+#include "module-toupper.h"
+
+enum {
+    maxRepetitions = 101,
+    textSize = 1 << 20,
+    // Keys of one cache measurement take about this many bytes.
+    cacheBytes = 16 << 20,
+    maxCacheKeys = 16384,
+    configKeys = 8
+};
+
+static int repetitions = 5;
+static const char *prefix = NULL;
+static char *text;
+
+static uint64_t nanoseconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + now.tv_nsec;
+}
+
+static int selected(const char *name)
+{
+    return !prefix || !strncmp(name, prefix, strlen(prefix));
+}
+
+static int compareSamples(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static void report(const char *name, const char *variant, size_t bytes, size_t ops, uint64_t *samples)
+{
+    qsort(samples, repetitions, sizeof(*samples), compareSamples);
+    double ns = (double)samples[repetitions / 2] / ops;
+    printf("%s %s %zu %.2f %.0f\n", name, variant, bytes, ns, ns > 0 ? bytes * 1e9 / ns : 0.0);
+    fflush(stdout);
+}
+
+// The path of a temporary file with the text, NULL in case it cannot
+// be written.
+static const char *writeTemp(const char *data, size_t length)
+{
+    static char path[] = "/tmp/hw04-bench-XXXXXX";
+    strcpy(path + strlen(path) - 6, "XXXXXX");
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        return NULL;
+    }
+    int rv = write(fd, data, length) != (ssize_t)length;
+    close(fd);
+    if (rv) {
+        unlink(path);
+        return NULL;
+    }
+    return path;
+}
+
+static int moduleInit(struct module *module, void (*init)(struct module *), const char *section, const char *data)
+{
+    init(module);
+    if (!module->privateData) {
+        return 1;
+    }
+
+    const char *path = writeTemp(data, strlen(data));
+    if (!path) {
+        return 1;
+    }
+    struct config cfg;
+    int rv = configRead(&cfg, path);
+    unlink(path);
+    if (!rv) {
+        rv = module->loadConfig(module, &cfg, section);
+        configClean(&cfg);
+    }
+    return rv;
+}
+
+static void moduleClean(struct module *module)
+{
+    if (module->cleanup) {
+        module->cleanup(module);
+    }
+}
+
+static void queryInit(struct query *query, const char *data, size_t length, struct arena *arena)
+{
+    initQuery(query);
+    query->query = data;
+    query->queryLength = length;
+    query->arena = arena;
+}
+
+// Distinct keys of the given length, the first bytes hold the index.
+static char *cacheKeys(size_t length, size_t count)
+{
+    char *keys = (char *)malloc(length * count);
+    if (!keys) {
+        return NULL;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        char *key = keys + i * length;
+        memcpy(key, text + (i * 7) % (textSize - length), length);
+        char index[17];
+        snprintf(index, sizeof(index), "%016zx", i);
+        memcpy(key, index, length < 16 ? length : 16);
+    }
+    return keys;
+}
+
+static void cacheFill(struct module *module, const char *keys, size_t length, size_t count,
+                      char *response, struct arena *arena)
+{
+    for (size_t i = 0; i < count; ++i) {
+        struct query query;
+        queryInit(&query, keys + i * length, length, arena);
+        module->process(module, &query);
+        querySetResponse(&query, response, length, 0);
+        module->postProcess(module, &query);
+    }
+}
+
+static void benchCache(void)
+{
+    static const size_t lengths[] = { 16, 256, 4096 };
+    static const int buckets[] = { 16, 1024, 65536 };
+    uint64_t samples[maxRepetitions];
+    struct arena arena;
+    arenaInit(&arena);
+    clockTick();
+
+    char *keys = NULL;
+    char *response = NULL;
+    for (size_t l = 0; l < sizeof(lengths) / sizeof(*lengths); ++l) {
+        size_t length = lengths[l];
+        size_t count = cacheBytes / length < maxCacheKeys ? cacheBytes / length : maxCacheKeys;
+        keys = cacheKeys(length, count);
+        response = (char *)malloc(length + 1);
+        if (!keys || !response) {
+            fprintf(stderr, "Allocation failed\n");
+            goto cleanup;
+        }
+        memcpy(response, text, length);
+        response[length] = '\0';
+
+        for (size_t b = 0; b < sizeof(buckets) / sizeof(*buckets); ++b) {
+            char data[128];
+            snprintf(data, sizeof(data), "[module::cache]\nTimeout = 3600\nBucketCount = %d\n", buckets[b]);
+            char variant[32];
+            snprintf(variant, sizeof(variant), "buckets=%d", buckets[b]);
+
+            if (selected("cache-insert")) {
+                // Every repetition starts with an empty cache.
+                for (int r = -1; r < repetitions; ++r) {
+                    struct module module;
+                    if (moduleInit(&module, moduleCache, "module::cache", data)) {
+                        fprintf(stderr, "Cannot initialize the cache\n");
+                        moduleClean(&module);
+                        goto cleanup;
+                    }
+                    uint64_t start = nanoseconds();
+                    cacheFill(&module, keys, length, count, response, &arena);
+                    uint64_t elapsed = nanoseconds() - start;
+                    moduleClean(&module);
+                    arenaReset(&arena);
+                    if (r >= 0) {
+                        samples[r] = elapsed;
+                    }
+                }
+                report("cache-insert", variant, length, count, samples);
+            }
+
+            if (selected("cache-hit")) {
+                struct module module;
+                if (moduleInit(&module, moduleCache, "module::cache", data)) {
+                    fprintf(stderr, "Cannot initialize the cache\n");
+                    moduleClean(&module);
+                    goto cleanup;
+                }
+                cacheFill(&module, keys, length, count, response, &arena);
+                arenaReset(&arena);
+                for (int r = -1; r < repetitions; ++r) {
+                    uint64_t start = nanoseconds();
+                    for (size_t i = 0; i < count; ++i) {
+                        struct query query;
+                        queryInit(&query, keys + i * length, length, &arena);
+                        module.process(&module, &query);
+                    }
+                    arenaReset(&arena);
+                    uint64_t elapsed = nanoseconds() - start;
+                    if (r >= 0) {
+                        samples[r] = elapsed;
+                    }
+                }
+                report("cache-hit", variant, length, count, samples);
+                moduleClean(&module);
+            }
+        }
+        free(keys);
+        free(response);
+        keys = NULL;
+        response = NULL;
+    }
+
+cleanup:
+    free(keys);
+    free(response);
+    arenaClean(&arena);
+}
+
+static void benchCase(const char *name, void (*init)(struct module *))
+{
+    static const size_t lengths[] = { 8, 64, 256, 4096 };
+    if (!selected(name)) {
+        return;
+    }
+
+    uint64_t samples[maxRepetitions];
+    struct arena arena;
+    arenaInit(&arena);
+    struct module module;
+    init(&module);
+
+    for (size_t l = 0; l < sizeof(lengths) / sizeof(*lengths); ++l) {
+        size_t length = lengths[l];
+        size_t ops = (16 << 20) / length;
+        for (int r = -1; r < repetitions; ++r) {
+            size_t offset = 0;
+            uint64_t start = nanoseconds();
+            for (size_t i = 0; i < ops; ++i) {
+                struct query query;
+                queryInit(&query, text + offset, length, &arena);
+                module.process(&module, &query);
+                offset += length + 7;
+                if (offset + length > textSize) {
+                    offset = 0;
+                }
+            }
+            arenaReset(&arena);
+            uint64_t elapsed = nanoseconds() - start;
+            if (r >= 0) {
+                samples[r] = elapsed;
+            }
+        }
+        report(name, "-", length, ops, samples);
+    }
+    arenaClean(&arena);
+}
+
+static void benchDecorate(void)
+{
+    static const size_t lengths[] = { 16, 256, 4096 };
+    static const char data[] = "[module::decorate]\nBold = 1\nUnderline = 0\nColor = red\n";
+    if (!selected("decorate")) {
+        return;
+    }
+
+    uint64_t samples[maxRepetitions];
+    struct module module;
+    if (moduleInit(&module, moduleDecorate, "module::decorate", data)) {
+        fprintf(stderr, "Cannot initialize decorate\n");
+        moduleClean(&module);
+        return;
+    }
+
+    for (int post = 0; post < 2; ++post) {
+        for (size_t l = 0; l < sizeof(lengths) / sizeof(*lengths); ++l) {
+            size_t length = lengths[l];
+            size_t ops = 1 << 20;
+            for (int r = -1; r < repetitions; ++r) {
+                uint64_t start = nanoseconds();
+                for (size_t i = 0; i < ops; ++i) {
+                    struct query query;
+                    queryInit(&query, text + i % (textSize - length), length, NULL);
+                    if (post) {
+                        querySetResponse(&query, text + i % (textSize - length), length, 0);
+                        module.postProcess(&module, &query);
+                    } else {
+                        module.process(&module, &query);
+                    }
+                }
+                uint64_t elapsed = nanoseconds() - start;
+                if (r >= 0) {
+                    samples[r] = elapsed;
+                }
+            }
+            // The calls only set pointers, so no bytes are reported.
+            char variant[32];
+            snprintf(variant, sizeof(variant), "%s,length=%zu", post ? "postProcess" : "process", length);
+            report("decorate", variant, 0, ops, samples);
+        }
+    }
+    moduleClean(&module);
+}
+
+// Sections like the module ones with a few keys each.
+static char *configText(size_t sections, size_t *length)
+{
+    size_t capacity = 64 + sections * (32 + configKeys * 32);
+    char *data = (char *)malloc(capacity);
+    if (!data) {
+        return NULL;
+    }
+    size_t used = 0;
+    for (size_t s = 0; s < sections; ++s) {
+        used += snprintf(data + used, capacity - used, "[module::m%zu]\n; Section %zu\n", s, s);
+        for (size_t k = 0; k < configKeys; ++k) {
+            used += snprintf(data + used, capacity - used, "Key%zu = %zu\n", k, s * configKeys + k + 2);
+        }
+    }
+    *length = used;
+    return data;
+}
+
+static void benchConfig(void)
+{
+    static const size_t sizes[] = { 10, 1000, 20000 };
+    uint64_t samples[maxRepetitions];
+
+    for (size_t n = 0; n < sizeof(sizes) / sizeof(*sizes); ++n) {
+        size_t sections = sizes[n];
+        size_t length;
+        char *data = configText(sections, &length);
+        const char *path = data ? writeTemp(data, length) : NULL;
+        free(data);
+        if (!path) {
+            fprintf(stderr, "Cannot write the config\n");
+            return;
+        }
+        char variant[32];
+        snprintf(variant, sizeof(variant), "sections=%zu", sections);
+
+        if (selected("config-read")) {
+            size_t ops = 200000 / sections;
+            for (int r = -1; r < repetitions; ++r) {
+                uint64_t start = nanoseconds();
+                for (size_t i = 0; i < ops; ++i) {
+                    struct config cfg;
+                    if (!configRead(&cfg, path)) {
+                        configClean(&cfg);
+                    }
+                }
+                uint64_t elapsed = nanoseconds() - start;
+                if (r >= 0) {
+                    samples[r] = elapsed;
+                }
+            }
+            report("config-read", variant, length, ops, samples);
+        }
+
+        struct config cfg;
+        if (selected("config-value") && !configRead(&cfg, path)) {
+            size_t ops = 1 << 20;
+            char (*names)[32] = (char (*)[32])malloc(sections * sizeof(*names));
+            for (size_t s = 0; names && s < sections; ++s) {
+                snprintf(names[s], sizeof(*names), "module::m%zu", s);
+            }
+            for (int r = -1; names && r < repetitions; ++r) {
+                uint64_t sum = 0;
+                uint64_t start = nanoseconds();
+                for (size_t i = 0; i < ops; ++i) {
+                    static const char *const keys[configKeys] = {
+                        "Key0", "Key1", "Key2", "Key3", "Key4", "Key5", "Key6", "Key7"
+                    };
+                    int value = 0;
+                    configValue(&cfg, names[(i * 7919) % sections], keys[i % configKeys], CfgInteger, &value);
+                    sum += (uint64_t)value;
+                }
+                uint64_t elapsed = nanoseconds() - start;
+                if (r >= 0) {
+                    samples[r] = elapsed;
+                }
+                // Keeps the lookups from being optimized out.
+                if (sum == 1) {
+                    printf("#\n");
+                }
+            }
+            if (names) {
+                report("config-value", variant, 0, ops, samples);
+            }
+            free(names);
+            configClean(&cfg);
+        }
+        unlink(path);
+    }
+}
+
+static void benchLogCase(const char *variant, enum logCodes code, int direct, size_t ops)
+{
+    uint64_t samples[maxRepetitions];
+    for (int r = -1; r < repetitions; ++r) {
+        uint64_t start = nanoseconds();
+        for (size_t i = 0; i < ops; ++i) {
+            if (direct) {
+                logFunction(__FILE__, __LINE__, code, "query %zu of the benchmark", i);
+            } else if (code == LDebug) {
+                LOG(LDebug, "query %zu of the benchmark", i);
+            } else {
+                LOG(LInfo, "query %zu of the benchmark", i);
+            }
+        }
+        uint64_t elapsed = nanoseconds() - start;
+        if (r >= 0) {
+            samples[r] = elapsed;
+        }
+    }
+    report("log", variant, 0, ops, samples);
+}
+
+// The asynchronous log cannot be stopped, so it is measured last.
+static void benchLog(void)
+{
+    if (!selected("log")) {
+        return;
+    }
+
+    setLogFile("/dev/null");
+    setLogLevel(LInfo);
+    benchLogCase("disabled-macro", LDebug, 0, 1 << 24);
+    benchLogCase("disabled-call", LDebug, 1, 1 << 24);
+    benchLogCase("enabled", LInfo, 0, 1 << 18);
+    if (!setLogAsync(4096, LogBlock)) {
+        benchLogCase("enabled-async", LInfo, 0, 1 << 18);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    repetitions = argc > 1 ? atoi(argv[1]) : 5;
+    prefix = argc > 2 ? argv[2] : NULL;
+    text = (char *)malloc(textSize);
+    if (!text || repetitions < 1 || repetitions > maxRepetitions) {
+        fprintf(stderr, "usage: %s [repetitions [benchmark prefix]]\n", argv[0]);
+        return 1;
+    }
+
+    srand(42);
+    for (size_t i = 0; i < textSize; ++i) {
+        text[i] = ' ' + rand() % 95;
+    }
+
+    // Only errors of the measured code are reported.
+    setLogLevel(LError);
+
+    printf("benchmark variant bytes ns/op bytes/s\n");
+    benchCache();
+    benchCase("toupper", moduleToUpper);
+    benchCase("tolower", moduleToLower);
+    benchDecorate();
+    benchConfig();
+    benchLog();
+
+    free(text);
+    return 0;
+}
@@ -0,0 +1,199 @@
+// Runs hw04 on an input file and measures the whole pipeline.
+//
+// Usage: hw04-load [-r repetitions] [-x hw04] config input
+//
+// Prints a line per run:
+//   run seconds lines/s MB/s peakRSS(KiB) hitRatio
+// MB/s counts the input. The output and the error output of hw04 go to
+// temporary files. The hit ratio comes from the hits and misses of the
+// cache in the statistics dump, so it needs [stats] Enabled = 1 with the
+// default File. It is "-" when there is no such dump. The peak RSS is the
+// largest of the runs so far.
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+static double seconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static int countLines(const char *file, size_t *lines, size_t *bytes)
+{
+    FILE *input = fopen(file, "r");
+    if (!input) {
+        return 1;
+    }
+
+    char buffer[1 << 16];
+    size_t read;
+    int last = '\n';
+    *lines = 0;
+    *bytes = 0;
+    while ((read = fread(buffer, 1, sizeof(buffer), input))) {
+        for (size_t i = 0; i < read; ++i) {
+            *lines += buffer[i] == '\n';
+        }
+        *bytes += read;
+        last = buffer[read - 1];
+    }
+    *lines += last != '\n';
+    fclose(input);
+    return 0;
+}
+
+// Hits and misses of the cache in the last statistics dump, text or JSON,
+// in the error output of hw04. Returns 0 in case there is none.
+static int countLookups(const char *file, unsigned long long *hits, unsigned long long *misses)
+{
+    FILE *errors = fopen(file, "r");
+    if (!errors) {
+        return 0;
+    }
+
+    int found = 0;
+    char *line = NULL;
+    size_t size = 0;
+    while (getline(&line, &size, errors) != -1) {
+        const char *json = strstr(line, "\"cache\":{\"hits\":");
+        if (!strncmp(line, "cache hits ", 11)) {
+            found |= sscanf(line, "cache hits %llu misses %llu", hits, misses) == 2;
+        } else if (json) {
+            found |= sscanf(json, "\"cache\":{\"hits\":%llu,\"misses\":%llu", hits, misses) == 2;
+        }
+    }
+    free(line);
+    fclose(errors);
+    return found;
+}
+
+static int run(const char *program, const char *config, const char *input,
+               const char *output, const char *errors)
+{
+    pid_t child = fork();
+    if (child < 0) {
+        return -1;
+    }
+    if (!child) {
+        int fd = open(output, O_WRONLY | O_TRUNC);
+        if (fd < 0 || dup2(fd, STDOUT_FILENO) < 0) {
+            _exit(127);
+        }
+        close(fd);
+        fd = open(errors, O_WRONLY | O_TRUNC);
+        if (fd < 0 || dup2(fd, STDERR_FILENO) < 0) {
+            _exit(127);
+        }
+        close(fd);
+        execl(program, program, config, input, (char *)NULL);
+        _exit(127);
+    }
+
+    int status;
+    if (waitpid(child, &status, 0) < 0) {
+        return -1;
+    }
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+static int usage(const char *name)
+{
+    fprintf(stderr, "usage: %s [-r repetitions] [-x hw04] config input\n", name);
+    return 1;
+}
+
+int main(int argc, char **argv)
+{
+    int repetitions = 3;
+    const char *program = NULL;
+
+    int option;
+    while ((option = getopt(argc, argv, "r:x:")) != -1) {
+        switch (option) {
+        case 'r': repetitions = atoi(optarg); break;
+        case 'x': program = optarg; break;
+        default: return usage(argv[0]);
+        }
+    }
+    if (optind + 2 != argc || repetitions < 1) {
+        return usage(argv[0]);
+    }
+    const char *config = argv[optind];
+    const char *input = argv[optind + 1];
+
+    // hw04 is built next to this tool.
+    char sibling[4096];
+    if (!program) {
+        const char *slash = strrchr(argv[0], '/');
+        size_t directory = slash ? (size_t)(slash - argv[0] + 1) : 0;
+        if (directory + sizeof("hw04") > sizeof(sibling)) {
+            return usage(argv[0]);
+        }
+        memcpy(sibling, argv[0], directory);
+        strcpy(sibling + directory, slash ? "hw04" : "./hw04");
+        program = sibling;
+    }
+
+    size_t lines, bytes;
+    if (countLines(input, &lines, &bytes)) {
+        fprintf(stderr, "Cannot read '%s'\n", input);
+        return 1;
+    }
+
+    char output[] = "/tmp/hw04-load-XXXXXX";
+    int fd = mkstemp(output);
+    if (fd < 0) {
+        fprintf(stderr, "Cannot create the output file\n");
+        return 1;
+    }
+    close(fd);
+
+    char errors[] = "/tmp/hw04-load-XXXXXX";
+    fd = mkstemp(errors);
+    if (fd < 0) {
+        fprintf(stderr, "Cannot create the error output file\n");
+        unlink(output);
+        return 1;
+    }
+    close(fd);
+
+    printf("run seconds lines/s MB/s peakRSS(KiB) hitRatio\n");
+    int rv = 0;
+    for (int r = 0; r < repetitions; ++r) {
+        double start = seconds();
+        int status = run(program, config, input, output, errors);
+        double elapsed = seconds() - start;
+        if (status) {
+            fprintf(stderr, "%s exited with %d\n", program, status);
+            rv = 1;
+            break;
+        }
+
+        struct rusage usage;
+        getrusage(RUSAGE_CHILDREN, &usage);
+        unsigned long long hits, misses;
+        int lookups = countLookups(errors, &hits, &misses);
+
+        printf("%d %.3f %.0f %.2f %ld ", r, elapsed, lines / elapsed, bytes / elapsed / 1e6, (long)usage.ru_maxrss);
+        if (lookups && hits + misses) {
+            printf("%.4f\n", (double)hits / (hits + misses));
+        } else {
+            printf("-\n");
+        }
+        fflush(stdout);
+    }
+
+    unlink(output);
+    unlink(errors);
+    return rv;
+}
@@ -0,0 +1,226 @@
+// Generates an input file for hw04 and optionally a config to run it with.
+//
+// Usage: hw04-workload [options] output
+//   -n lines      number of lines (default 100000)
+//   -l min-max    length of the lines, uniformly distributed (default 8-64)
+//   -k keys       number of distinct lines (default 10000)
+//   -s exponent   Zipf exponent of the repetition, 0 for uniform (default 1.0)
+//   -m            mixed case, digits and punctuation instead of lower case
+//   -r seed       seed of the generator (default 1)
+//   -c config     write a config as well, with:
+//   -p modules    Process (default "cache")
+//   -P modules    PostProcess (default "decorate cache")
+//   -t threads    Threads (default 1)
+//   -b buckets    BucketCount of the cache (default 1024)
+//   -T seconds    Timeout of the cache (default 60)
+//
+// Line i of the keys always has the same text for the same seed, so runs
+// with different settings see the same workload.
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+struct workload {
+    size_t lines;
+    size_t minLength;
+    size_t maxLength;
+    size_t keys;
+    double exponent;
+    int mixed;
+    uint64_t seed;
+};
+
+struct setup {
+    const char *process;
+    const char *postProcess;
+    int threads;
+    int buckets;
+    int timeout;
+};
+
+// xorshift64*, the same sequence on every platform.
+static uint64_t next(uint64_t *state)
+{
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545F4914F6CDD1Dull;
+}
+
+static double uniform(uint64_t *state)
+{
+    return (next(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// Text of the key of the given rank.
+static size_t keyText(const struct workload *workload, size_t rank, char *text)
+{
+    static const char lower[] = "abcdefghijklmnopqrstuvwxyz    ";
+    static const char mixed[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789 .,:;-+=!?()";
+    const char *alphabet = workload->mixed ? mixed : lower;
+    size_t size = workload->mixed ? sizeof(mixed) - 1 : sizeof(lower) - 1;
+
+    uint64_t state = (workload->seed + 1) * 0x9E3779B97F4A7C15ull ^ (rank + 1);
+    next(&state);
+    size_t length = workload->minLength + next(&state) % (workload->maxLength - workload->minLength + 1);
+    for (size_t i = 0; i < length; ++i) {
+        text[i] = alphabet[next(&state) % size];
+    }
+    // The reader strips white space at the ends of the lines.
+    if (length) {
+        text[0] = alphabet[rank % 26];
+        text[length - 1] = alphabet[(rank / 26) % 26];
+    }
+    return length;
+}
+
+// Cumulative probabilities of the ranks.
+static double *zipfTable(size_t keys, double exponent)
+{
+    double *table = (double *)malloc(keys * sizeof(double));
+    if (!table) {
+        return NULL;
+    }
+    double sum = 0;
+    for (size_t k = 0; k < keys; ++k) {
+        sum += 1.0 / pow((double)(k + 1), exponent);
+        table[k] = sum;
+    }
+    for (size_t k = 0; k < keys; ++k) {
+        table[k] /= sum;
+    }
+    return table;
+}
+
+static size_t zipfRank(const double *table, size_t keys, double p)
+{
+    size_t low = 0, high = keys - 1;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        if (table[middle] < p) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+static int writeInput(const struct workload *workload, const char *file)
+{
+    FILE *output = fopen(file, "w");
+    double *table = zipfTable(workload->keys, workload->exponent);
+    char *text = (char *)malloc(workload->maxLength + 1);
+    if (!output || !table || !text) {
+        fprintf(stderr, "Cannot write '%s'\n", file);
+        if (output) {
+            fclose(output);
+        }
+        free(table);
+        free(text);
+        return 1;
+    }
+
+    uint64_t state = workload->seed * 0xD1B54A32D192ED03ull + 1;
+    for (size_t i = 0; i < workload->lines; ++i) {
+        size_t rank = zipfRank(table, workload->keys, uniform(&state));
+        size_t length = keyText(workload, rank, text);
+        text[length] = '\n';
+        fwrite(text, 1, length + 1, output);
+    }
+
+    free(table);
+    free(text);
+    return fclose(output) ? 1 : 0;
+}
+
+static int writeConfig(const struct setup *setup, const char *file)
+{
+    FILE *output = fopen(file, "w");
+    if (!output) {
+        fprintf(stderr, "Cannot write '%s'\n", file);
+        return 1;
+    }
+
+    fprintf(output,
+            "[log]\n"
+            "File  = /dev/null\n"
+            "Level = E\n"
+            "\n"
+            "[run]\n"
+            "Process     = %s\n"
+            "PostProcess = %s\n"
+            "Threads     = %d\n"
+            "\n"
+            "; hw04-load takes the hit ratio from the statistics.\n"
+            "[stats]\n"
+            "Enabled = 1\n"
+            "\n"
+            "[module::cache]\n"
+            "Timeout     = %d\n"
+            "BucketCount = %d\n"
+            "\n"
+            "[module::decorate]\n"
+            "Bold      = 1\n"
+            "Underline = 0\n"
+            "Color     = red\n",
+            setup->process, setup->postProcess, setup->threads,
+            setup->timeout, setup->buckets);
+    return fclose(output) ? 1 : 0;
+}
+
+static int usage(const char *name)
+{
+    fprintf(stderr,
+            "usage: %s [-n lines] [-l min-max] [-k keys] [-s exponent] [-m] [-r seed]\n"
+            "       [-c config [-p modules] [-P modules] [-t threads] [-b buckets] [-T seconds]] output\n",
+            name);
+    return 1;
+}
+
+int main(int argc, char **argv)
+{
+    struct workload workload = { 100000, 8, 64, 10000, 1.0, 0, 1 };
+    struct setup setup = { "cache", "decorate cache", 1, 1024, 60 };
+    const char *config = NULL;
+
+    int option;
+    while ((option = getopt(argc, argv, "n:l:k:s:mr:c:p:P:t:b:T:")) != -1) {
+        switch (option) {
+        case 'n': workload.lines = strtoul(optarg, NULL, 10); break;
+        case 'l':
+            if (sscanf(optarg, "%zu-%zu", &workload.minLength, &workload.maxLength) != 2) {
+                return usage(argv[0]);
+            }
+            break;
+        case 'k': workload.keys = strtoul(optarg, NULL, 10); break;
+        case 's': workload.exponent = strtod(optarg, NULL); break;
+        case 'm': workload.mixed = 1; break;
+        case 'r': workload.seed = strtoull(optarg, NULL, 10); break;
+        case 'c': config = optarg; break;
+        case 'p': setup.process = optarg; break;
+        case 'P': setup.postProcess = optarg; break;
+        case 't': setup.threads = atoi(optarg); break;
+        case 'b': setup.buckets = atoi(optarg); break;
+        case 'T': setup.timeout = atoi(optarg); break;
+        default: return usage(argv[0]);
+        }
+    }
+
+    if (optind + 1 != argc || !workload.keys || !workload.minLength
+        || workload.minLength > workload.maxLength || workload.exponent < 0) {
+        return usage(argv[0]);
+    }
+
+    if (writeInput(&workload, argv[optind])) {
+        return 1;
+    }
+    if (config && writeConfig(&setup, config)) {
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,144 @@
+// MAP_ANONYMOUS and MAP_HUGETLB are not part of POSIX.
+#define _DEFAULT_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "cache-slab.h"
+#include "log.h"
+
+enum {
+    slabAlign = 16,
+    chunkSize = 256 << 10,
+    hugeChunkSize = 2 << 20
+};
+
+struct slabChunk {
+    struct slabChunk *next;
+    size_t size;
+};
+
+// The chunk header keeps the blocks aligned.
+static const size_t chunkHeader = (sizeof(struct slabChunk) + slabAlign - 1) & ~(size_t)(slabAlign - 1);
+
+static size_t classIndex(size_t size)
+{
+    if (size <= 128) {
+        return size ? (size - 1) >> 4 : 0;
+    }
+    unsigned shift = 63 - __builtin_clzll((unsigned long long)(size - 1));
+    return 8 + (shift - 7) * 4 + ((size - 1 - ((size_t)1 << shift)) >> (shift - 2));
+}
+
+static size_t classSize(size_t index)
+{
+    if (index < 8) {
+        return (index + 1) * 16;
+    }
+    size_t base = (size_t)128 << ((index - 8) / 4);
+    return base + ((index - 8) % 4 + 1) * (base / 4);
+}
+
+static struct slabChunk *mapChunk(struct slabAllocator *slab)
+{
+    void *data = MAP_FAILED;
+#ifdef MAP_HUGETLB
+    if (slab->hugePages) {
+        data = mmap(NULL, hugeChunkSize, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (data == MAP_FAILED) {
+            LOG(LWarn, "Huge pages are not available, using normal pages");
+            slab->hugePages = 0;
+        }
+    }
+#endif
+    if (data == MAP_FAILED) {
+        data = mmap(NULL, slab->chunkSize, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    }
+    if (data == MAP_FAILED) {
+        LOG(LFatal, "Allocation failed (%zu bytes)", slab->chunkSize);
+        return NULL;
+    }
+
+    struct slabChunk *chunk = (struct slabChunk *)data;
+    chunk->size = slab->chunkSize;
+    chunk->next = slab->chunks;
+    slab->chunks = chunk;
+    return chunk;
+}
+
+void slabInit(struct slabAllocator *slab, int hugePages)
+{
+    memset(slab, 0, sizeof(struct slabAllocator));
+#ifdef MAP_HUGETLB
+    slab->hugePages = hugePages;
+#else
+    (void)hugePages;
+#endif
+    slab->chunkSize = slab->hugePages ? hugeChunkSize : chunkSize;
+}
+
+void *slabAlloc(struct slabAllocator *slab, size_t size)
+{
+    if (size > slabLargeSize) {
+        void *block = malloc(size);
+        if (!block) {
+            LOG(LFatal, "Allocation failed (%zu bytes)", size);
+        }
+        return block;
+    }
+
+    size_t index = classIndex(size);
+    char *block = slab->free[index];
+    if (block) {
+        memcpy(&slab->free[index], block, sizeof(char *));
+        return block;
+    }
+
+    size_t blockSize = classSize(index);
+    if (slab->left < blockSize) {
+        // The rest of the old chunk is given up.
+        struct slabChunk *chunk = mapChunk(slab);
+        if (!chunk) {
+            return NULL;
+        }
+        slab->top = (char *)chunk + chunkHeader;
+        slab->left = chunk->size - chunkHeader;
+    }
+    block = slab->top;
+    slab->top += blockSize;
+    slab->left -= blockSize;
+    return block;
+}
+
+void slabFree(struct slabAllocator *slab, void *block, size_t size)
+{
+    if (!block) {
+        return;
+    }
+    if (size > slabLargeSize) {
+        free(block);
+        return;
+    }
+
+    size_t index = classIndex(size);
+    memcpy(block, &slab->free[index], sizeof(char *));
+    slab->free[index] = (char *)block;
+}
+
+size_t slabBlockSize(size_t size)
+{
+    return size > slabLargeSize ? size : classSize(classIndex(size));
+}
+
+void slabClean(struct slabAllocator *slab)
+{
+    while (slab->chunks) {
+        struct slabChunk *chunk = slab->chunks;
+        slab->chunks = chunk->next;
+        munmap(chunk, chunk->size);
+    }
+    slabInit(slab, slab->hugePages);
+}
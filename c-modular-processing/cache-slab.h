@@ -0,0 +1,65 @@
+#ifndef CACHE_SLAB_H
+#define CACHE_SLAB_H
+
+#include <stddef.h>
+
+struct slabChunk;
+
+enum {
+    // Sizes up to 128 bytes step by 16, then every power of two range
+    // is split into 4 classes up to slabLargeSize.
+    slabClasses = 44,
+    // Larger blocks are allocated by malloc.
+    slabLargeSize = 64 << 10
+};
+
+// Blocks of similar size carved from big chunks, freed blocks wait in
+// a free list of their class. Not synchronized.
+struct slabAllocator {
+    struct slabChunk *chunks;
+    char *free[slabClasses];
+    char *top;
+    size_t left;
+    size_t chunkSize;
+    int hugePages;
+};
+
+/** Initialize an empty allocator
+ *
+ *  @param slab The allocator.
+ *  @param hugePages Nonzero to back the chunks by huge pages, when the
+ *                   system has them.
+ */
+void slabInit(struct slabAllocator *slab, int hugePages);
+
+/** Allocate a block
+ *
+ *  @param slab The allocator.
+ *  @param size The number of bytes.
+ *  @return the block aligned to 16 bytes or NULL in case the allocation fails
+ */
+void *slabAlloc(struct slabAllocator *slab, size_t size);
+
+/** Return a block into its free list
+ *
+ *  @param slab The allocator.
+ *  @param block The block, may be NULL.
+ *  @param size The size the block was allocated with.
+ */
+void slabFree(struct slabAllocator *slab, void *block, size_t size);
+
+/** The number of bytes the block of given size really takes.
+ *
+ *  @param size The size of the block.
+ */
+size_t slabBlockSize(size_t size);
+
+/** Release all chunks
+ *
+ *  Blocks larger than slabLargeSize must be freed before.
+ *
+ *  @param slab The allocator.
+ */
+void slabClean(struct slabAllocator *slab);
+
+#endif
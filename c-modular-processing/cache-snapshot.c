@@ -0,0 +1,244 @@
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cache-snapshot.h"
+#include "clock.h"
+#include "log.h"
+
+// Bump when the layout or the hash function changes, stored hashes
+// are used as they are.
+enum {
+    snapshotVersion = 2
+};
+
+static const char snapshotMagic[8] = { 'H', 'W', '0', '4', 'C', 'A', 'C', 'H' };
+
+struct snapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t recordSize;
+    uint64_t count;
+    uint64_t blobSize;
+};
+
+struct snapshotRecord {
+    uint64_t hash;
+    // Milliseconds since the epoch.
+    int64_t timeOfDeath;
+    // Offsets into the blob.
+    uint64_t key;
+    uint64_t response;
+    uint64_t keyLength;
+    uint64_t responseLength;
+    int32_t responseCode;
+    uint32_t reserved;
+};
+
+struct snapshot {
+    void *data;
+    size_t size;
+    const struct snapshotHeader *header;
+    const struct snapshotRecord *records;
+    const char *blob;
+};
+
+static int writeAll(FILE *out, const void *data, size_t size)
+{
+    return fwrite(data, 1, size, out) != size;
+}
+
+// Returns the next live item of the clock lists after item, or the
+// first one in case item is NULL.
+static const struct cacheItem *nextItem(const struct cacheItem *const *clocks,
+                                        size_t clockCount,
+                                        size_t *clock,
+                                        const struct cacheItem *item,
+                                        uint64_t now)
+{
+    for (;;) {
+        if (item && item->clockNext != clocks[*clock]) {
+            item = item->clockNext;
+        } else {
+            if (item) {
+                ++*clock;
+            }
+            while (*clock < clockCount && !clocks[*clock]) {
+                ++*clock;
+            }
+            if (*clock == clockCount) {
+                return NULL;
+            }
+            item = clocks[*clock];
+        }
+        if (item->timeOfDeath >= now) {
+            return item;
+        }
+    }
+}
+
+long snapshotSave(const char *file,
+                  const struct cacheItem *const *clocks,
+                  size_t clockCount,
+                  uint64_t now)
+{
+    struct snapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, snapshotMagic, sizeof(snapshotMagic));
+    header.version = snapshotVersion;
+    header.recordSize = sizeof(struct snapshotRecord);
+
+    const struct cacheItem *item = NULL;
+    size_t clock = 0;
+    while ((item = nextItem(clocks, clockCount, &clock, item, now))) {
+        ++header.count;
+        header.blobSize += item->keyLength + item->responseLength + 2;
+    }
+
+    size_t length = strlen(file);
+    char *temporary = (char *)malloc(length + 5);
+    if (!temporary) {
+        LOG(LFatal, "Allocation failed (%zu bytes)", length + 5);
+        return -1;
+    }
+    memcpy(temporary, file, length);
+    memcpy(temporary + length, ".tmp", 5);
+
+    FILE *out = fopen(temporary, "wb");
+    if (!out) {
+        LOG(LError, "Cannot open snapshot file '%s'", temporary);
+        free(temporary);
+        return -1;
+    }
+
+    int failed = writeAll(out, &header, sizeof(header));
+    int64_t wall = clockWall();
+
+    uint64_t offset = 0;
+    clock = 0;
+    while (!failed && (item = nextItem(clocks, clockCount, &clock, item, now))) {
+        struct snapshotRecord record;
+        memset(&record, 0, sizeof(record));
+        record.hash = item->hash;
+        record.timeOfDeath = wall + (int64_t)(item->timeOfDeath - now);
+        record.key = offset;
+        record.keyLength = item->keyLength;
+        record.response = offset + item->keyLength + 1;
+        record.responseLength = item->responseLength;
+        record.responseCode = item->responseCode;
+        offset = record.response + item->responseLength + 1;
+        failed = writeAll(out, &record, sizeof(record));
+    }
+
+    clock = 0;
+    while (!failed && (item = nextItem(clocks, clockCount, &clock, item, now))) {
+        failed = writeAll(out, item->key, item->keyLength + 1)
+            || writeAll(out, item->response, item->responseLength + 1);
+    }
+
+    if (fclose(out) || failed || rename(temporary, file)) {
+        LOG(LError, "Cannot write snapshot file '%s'", file);
+        remove(temporary);
+        free(temporary);
+        return -1;
+    }
+    free(temporary);
+    return (long)header.count;
+}
+
+struct snapshot *snapshotOpen(const char *file)
+{
+    int fd = open(file, O_RDONLY);
+    if (fd < 0) {
+        LOG(LInfo, "No snapshot file '%s'", file);
+        return NULL;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) || (size_t)info.st_size < sizeof(struct snapshotHeader)) {
+        LOG(LWarn, "Invalid snapshot file '%s'", file);
+        close(fd);
+        return NULL;
+    }
+
+    size_t size = info.st_size;
+    void *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        LOG(LError, "Cannot map snapshot file '%s'", file);
+        return NULL;
+    }
+
+    const struct snapshotHeader *header = (const struct snapshotHeader *)data;
+    size_t available = size - sizeof(struct snapshotHeader);
+    if (memcmp(header->magic, snapshotMagic, sizeof(snapshotMagic))
+            || header->version != snapshotVersion
+            || header->recordSize != sizeof(struct snapshotRecord)
+            || header->count > available / sizeof(struct snapshotRecord)
+            || header->blobSize != available - header->count * sizeof(struct snapshotRecord)) {
+        LOG(LWarn, "Invalid snapshot file '%s'", file);
+        munmap(data, size);
+        return NULL;
+    }
+
+    struct snapshot *snapshot = (struct snapshot *)malloc(sizeof(struct snapshot));
+    if (!snapshot) {
+        LOG(LFatal, "Allocation failed (%zu bytes)", sizeof(struct snapshot));
+        munmap(data, size);
+        return NULL;
+    }
+    posix_madvise(data, size, POSIX_MADV_SEQUENTIAL);
+    snapshot->data = data;
+    snapshot->size = size;
+    snapshot->header = header;
+    snapshot->records = (const struct snapshotRecord *)(header + 1);
+    snapshot->blob = (const char *)(snapshot->records + header->count);
+    return snapshot;
+}
+
+size_t snapshotCount(const struct snapshot *snapshot)
+{
+    return snapshot->header->count;
+}
+
+static int inBlob(const struct snapshot *snapshot, uint64_t offset, uint64_t length)
+{
+    uint64_t blobSize = snapshot->header->blobSize;
+    return offset < blobSize
+        && length < blobSize - offset
+        && snapshot->blob[offset + length] == '\0';
+}
+
+int snapshotItem(const struct snapshot *snapshot, size_t index, struct cacheItem *item)
+{
+    const struct snapshotRecord *record = &snapshot->records[index];
+    if (!inBlob(snapshot, record->key, record->keyLength)
+            || !inBlob(snapshot, record->response, record->responseLength)) {
+        return 1;
+    }
+
+    memset(item, 0, sizeof(struct cacheItem));
+    item->key = (char *)snapshot->blob + record->key;
+    item->keyLength = record->keyLength;
+    item->response = (char *)snapshot->blob + record->response;
+    item->responseLength = record->responseLength;
+    item->responseCode = (enum responseCode)record->responseCode;
+    int64_t remaining = record->timeOfDeath - clockWall();
+    item->timeOfDeath = remaining > 0 ? clockNow() + remaining : 0;
+    item->hash = (size_t)record->hash;
+    return 0;
+}
+
+void snapshotClose(struct snapshot *snapshot)
+{
+    if (!snapshot) {
+        return;
+    }
+    munmap(snapshot->data, snapshot->size);
+    free(snapshot);
+}
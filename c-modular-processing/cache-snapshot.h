@@ -0,0 +1,65 @@
+#ifndef CACHE_SNAPSHOT_H
+#define CACHE_SNAPSHOT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cache-table.h"
+
+// The file holds a header, an array of fixed size records and a blob
+// with the keys and responses, each terminated by '\0'. It is mapped
+// and used in place, only the bounds of every record are checked.
+struct snapshot;
+
+/** Write live items into a snapshot file
+ *
+ *  The file is written under a temporary name and renamed, so an
+ *  interrupted write never replaces a good snapshot.
+ *
+ *  @param file The path of the snapshot.
+ *  @param clocks Items of the clock lists, every list is written in the
+ *                clock order starting with its item. Items may be NULL.
+ *  @param clockCount The number of the clock lists.
+ *  @param now The current clockNow, items which expired before are
+ *             left out. The expiry is stored as the wall clock time.
+ *  @return the number of written items or -1 in case of failure
+ */
+long snapshotSave(const char *file,
+                  const struct cacheItem *const *clocks,
+                  size_t clockCount,
+                  uint64_t now);
+
+/** Map a snapshot file
+ *
+ *  @param file The path of the snapshot.
+ *  @return the snapshot or NULL in case the file is missing or invalid
+ */
+struct snapshot *snapshotOpen(const char *file);
+
+/** Number of items in the snapshot.
+ *
+ *  @param snapshot The snapshot.
+ */
+size_t snapshotCount(const struct snapshot *snapshot);
+
+/** Read an item of the snapshot
+ *
+ *  The key and the response of the item point into the mapped file and
+ *  are valid until snapshotClose; the clock and wheel links are not set.
+ *  The expiry is converted to clockNow, it is 0 for expired items.
+ *
+ *  @param snapshot The snapshot.
+ *  @param index The index of the item, less than snapshotCount.
+ *  @param item The output parameter for the item.
+ *  @return 0 in case of success
+ *          1 in case the record is corrupted
+ */
+int snapshotItem(const struct snapshot *snapshot, size_t index, struct cacheItem *item);
+
+/** Unmap the snapshot.
+ *
+ *  @param snapshot The snapshot, may be NULL.
+ */
+void snapshotClose(struct snapshot *snapshot);
+
+#endif
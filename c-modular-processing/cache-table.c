@@ -0,0 +1,339 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "cache-table.h"
+#include "log.h"
+
+enum {
+    groupWidth = tableGroupWidth,
+    // Slots moved from the previous array on every insertion.
+    migrateStep = 2 * groupWidth
+};
+
+enum control {
+    CtrlEmpty = 0x80,
+    CtrlDeleted = 0xFE
+    // Full slots store the low 7 bits of the hash.
+};
+
+static const uint64_t lsbs = 0x0101010101010101ull;
+static const uint64_t msbs = 0x8080808080808080ull;
+
+static uint64_t loadGroup(const uint8_t *ctrl)
+{
+    uint64_t group = 0;
+    for (int i = groupWidth - 1; i >= 0; --i) {
+        group = (group << 8) | ctrl[i];
+    }
+    return group;
+}
+
+// Bytes equal to h2 have their top bit set in the result.
+static uint64_t matchGroup(uint64_t group, uint8_t h2)
+{
+    uint64_t x = group ^ (lsbs * h2);
+    return (x - lsbs) & ~x & msbs;
+}
+
+static uint64_t matchEmpty(uint64_t group)
+{
+    return group & (~group << 6) & msbs;
+}
+
+static uint64_t matchEmptyOrDeleted(uint64_t group)
+{
+    return group & (~group << 7) & msbs;
+}
+
+static size_t firstByte(uint64_t mask)
+{
+    return __builtin_ctzll(mask) / 8;
+}
+
+static void setCtrl(struct tableArray *array, size_t index, uint8_t value)
+{
+    array->ctrl[index] = value;
+    if (index < groupWidth) {
+        array->ctrl[array->capacity + index] = value;
+    }
+}
+
+static int arrayInit(struct tableArray *array, size_t capacity)
+{
+    array->ctrl = (uint8_t *)malloc(capacity + groupWidth);
+    array->slots = (struct cacheItem **)calloc(capacity, sizeof(struct cacheItem *));
+    if (!array->ctrl || !array->slots) {
+        LOG(LFatal, "Allocation failed (%zu bytes)", capacity * sizeof(struct cacheItem *));
+        free(array->ctrl);
+        free(array->slots);
+        memset(array, 0, sizeof(struct tableArray));
+        return 1;
+    }
+    memset(array->ctrl, CtrlEmpty, capacity + groupWidth);
+    array->capacity = capacity;
+    array->size = 0;
+    array->tombstones = 0;
+    return 0;
+}
+
+static void arrayClean(struct tableArray *array, tableReleaseFn release)
+{
+    if (release) {
+        for (size_t i = 0; i < array->capacity; ++i) {
+            if (array->ctrl[i] < CtrlEmpty) {
+                release(array->slots[i]);
+            }
+        }
+    }
+    free(array->ctrl);
+    free(array->slots);
+    memset(array, 0, sizeof(struct tableArray));
+}
+
+// In case the item is missing and freeSlot is not NULL, it is set to
+// the slot where the item would be placed.
+static struct cacheItem *arrayFind(struct tableArray *array,
+                                   size_t hash,
+                                   const char *key,
+                                   size_t length,
+                                   size_t *index,
+                                   size_t *freeSlot)
+{
+    if (!array->capacity || (!array->size && !freeSlot)) {
+        return NULL;
+    }
+
+    size_t mask = array->capacity - 1;
+    uint8_t h2 = hash & 0x7F;
+    for (size_t pos = (hash >> 7) & mask;; pos = (pos + groupWidth) & mask) {
+        uint64_t group = loadGroup(array->ctrl + pos);
+        uint64_t available = matchEmptyOrDeleted(group);
+        if (freeSlot && available) {
+            *freeSlot = (pos + firstByte(available)) & mask;
+            freeSlot = NULL;
+        }
+        for (uint64_t match = matchGroup(group, h2); match; match &= match - 1) {
+            size_t i = (pos + firstByte(match)) & mask;
+            struct cacheItem *item = array->slots[i];
+            if (item->hash == hash
+                    && item->keyLength == length
+                    && memcmp(item->key, key, length) == 0) {
+                *index = i;
+                return item;
+            }
+        }
+        if (matchEmpty(group)) {
+            return NULL;
+        }
+    }
+}
+
+static void arrayPlaceAt(struct tableArray *array, struct cacheItem *item, size_t index)
+{
+    if (array->ctrl[index] == CtrlDeleted) {
+        --array->tombstones;
+    }
+    setCtrl(array, index, item->hash & 0x7F);
+    array->slots[index] = item;
+    ++array->size;
+}
+
+static void arrayPlace(struct tableArray *array, struct cacheItem *item)
+{
+    size_t mask = array->capacity - 1;
+    for (size_t pos = (item->hash >> 7) & mask;; pos = (pos + groupWidth) & mask) {
+        uint64_t available = matchEmptyOrDeleted(loadGroup(array->ctrl + pos));
+        if (available) {
+            arrayPlaceAt(array, item, (pos + firstByte(available)) & mask);
+            return;
+        }
+    }
+}
+
+static size_t capacityFor(size_t items)
+{
+    size_t capacity = groupWidth;
+    while (capacity - capacity / 8 <= items) {
+        capacity *= 2;
+    }
+    return capacity;
+}
+
+// The array keeps at least 1/8 of its slots empty, so every probe
+// meets an empty slot.
+static int arrayFull(const struct tableArray *array)
+{
+    return array->size + array->tombstones + 1 > array->capacity - array->capacity / 8;
+}
+
+static void migrate(struct cacheTable *table, size_t slots)
+{
+    struct tableArray *previous = &table->previous;
+    if (!previous->ctrl) {
+        return;
+    }
+
+    for (; slots && table->migrated < previous->capacity; --slots, ++table->migrated) {
+        size_t i = table->migrated;
+        if (previous->ctrl[i] < CtrlEmpty) {
+            // The rest moves at once when the current array grows.
+            if (arrayFull(&table->current)) {
+                return;
+            }
+            arrayPlace(&table->current, previous->slots[i]);
+            setCtrl(previous, i, CtrlDeleted);
+            --previous->size;
+        }
+    }
+
+    if (table->migrated == previous->capacity) {
+        arrayClean(previous, NULL);
+        table->migrated = 0;
+    }
+}
+
+static int grow(struct cacheTable *table)
+{
+    size_t items = tableSize(table);
+    struct tableArray array;
+    if (arrayInit(&array, capacityFor(items + items / 2 + 1))) {
+        return 1;
+    }
+
+    // Leftovers of an unfinished migration are moved at once.
+    struct tableArray *previous = &table->previous;
+    for (; table->migrated < previous->capacity; ++table->migrated) {
+        if (previous->ctrl[table->migrated] < CtrlEmpty) {
+            arrayPlace(&array, previous->slots[table->migrated]);
+        }
+    }
+    arrayClean(previous, NULL);
+
+    LOG(LDebug, "Cache table grows (items: %zu, capacity: %zu -> %zu)",
+        items, table->current.capacity, array.capacity);
+    table->previous = table->current;
+    table->current = array;
+    table->migrated = 0;
+    ++table->generation;
+    return 0;
+}
+
+int tableInit(struct cacheTable *table, size_t capacity)
+{
+    memset(table, 0, sizeof(struct cacheTable));
+    table->generation = 1;
+    return arrayInit(&table->current, capacityFor(capacity));
+}
+
+struct cacheItem *tableFind(struct cacheTable *table,
+                            size_t hash,
+                            const char *key,
+                            size_t length,
+                            struct tablePosition *position,
+                            struct insertHint *hint)
+{
+    struct tableArray *arrays[] = { &table->current, &table->previous };
+    size_t freeSlot = 0;
+
+    for (size_t a = 0; a < sizeof(arrays) / sizeof(*arrays); ++a) {
+        size_t index;
+        struct cacheItem *item = arrayFind(arrays[a], hash, key, length, &index,
+                                           hint && !a ? &freeSlot : NULL);
+        if (item) {
+            if (position) {
+                position->array = arrays[a];
+                position->index = index;
+            }
+            return item;
+        }
+    }
+
+    if (hint) {
+        hint->generation = table->generation;
+        hint->removals = table->removals;
+        hint->index = freeSlot;
+    }
+    return NULL;
+}
+
+// Filling free slots never moves the place where a missing key would be
+// inserted, removals and a new array do.
+int tableHintValid(const struct cacheTable *table, const struct insertHint *hint)
+{
+    return hint
+        && hint->generation == table->generation
+        && hint->removals == table->removals
+        && table->current.ctrl[hint->index] >= CtrlEmpty;
+}
+
+int tableInsert(struct cacheTable *table, struct cacheItem *item, const struct insertHint *hint)
+{
+    if (arrayFull(&table->current)) {
+        if (grow(table)) {
+            return 1;
+        }
+    }
+
+    if (tableHintValid(table, hint)) {
+        arrayPlaceAt(&table->current, item, hint->index);
+    } else {
+        arrayPlace(&table->current, item);
+    }
+
+    migrate(table, migrateStep);
+    return 0;
+}
+
+struct cacheItem *tableRemove(struct cacheTable *table, const struct tablePosition *position)
+{
+    struct tableArray *array = position->array;
+    struct cacheItem *item = array->slots[position->index];
+
+    setCtrl(array, position->index, CtrlDeleted);
+    array->slots[position->index] = NULL;
+    ++array->tombstones;
+    --array->size;
+    ++table->removals;
+    return item;
+}
+
+size_t tableSize(const struct cacheTable *table)
+{
+    return table->current.size + table->previous.size;
+}
+
+static void arrayStatsAdd(const struct tableArray *array, struct tableStats *stats)
+{
+    size_t mask = array->capacity - 1;
+    for (size_t group = 0; group < array->capacity; group += groupWidth) {
+        size_t full = 0;
+        for (size_t i = group; i < group + groupWidth; ++i) {
+            if (array->ctrl[i] >= CtrlEmpty) {
+                continue;
+            }
+            ++full;
+            // Probes visit the groups starting at the home slot.
+            size_t home = (array->slots[i]->hash >> 7) & mask;
+            size_t probes = ((i - home) & mask) / groupWidth;
+            ++stats->probeLengths[probes < tableProbeLengths ? probes : tableProbeLengths - 1];
+        }
+        ++stats->groupOccupancy[full];
+    }
+
+    stats->capacity += array->capacity;
+    stats->size += array->size;
+    stats->tombstones += array->tombstones;
+}
+
+void tableStatsAdd(const struct cacheTable *table, struct tableStats *stats)
+{
+    arrayStatsAdd(&table->current, stats);
+    arrayStatsAdd(&table->previous, stats);
+}
+
+void tableClean(struct cacheTable *table, tableReleaseFn release)
+{
+    arrayClean(&table->current, release);
+    arrayClean(&table->previous, release);
+    table->migrated = 0;
+}
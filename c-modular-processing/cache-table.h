@@ -0,0 +1,158 @@
+#ifndef CACHE_TABLE_H
+#define CACHE_TABLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "query.h"
+
+struct cacheItem {
+    char *key;
+    size_t keyLength;
+    char *response;
+    size_t responseLength;
+    enum responseCode responseCode;
+    // Milliseconds of clockNow.
+    uint64_t timeOfDeath;
+    size_t hash;
+
+    // Circular list of all items, swept by the eviction clock.
+    struct cacheItem *clockPrev;
+    struct cacheItem *clockNext;
+    int referenced;
+
+    // List of a timer wheel slot.
+    struct cacheItem *wheelNext;
+    struct cacheItem **wheelPrev;
+    unsigned wheelSlot;
+};
+
+enum {
+    // Slots probed at once.
+    tableGroupWidth = 8,
+    // Probe lengths told apart by tableStatsAdd.
+    tableProbeLengths = 8
+};
+
+// One open addressing array; ctrl holds a metadata byte per slot
+// followed by a copy of the first group so groups never wrap around.
+struct tableArray {
+    uint8_t *ctrl;
+    struct cacheItem **slots;
+    size_t capacity;
+    size_t size;
+    size_t tombstones;
+};
+
+// While growing, items are moved from previous to current a few slots
+// per insertion, lookups consult both arrays.
+struct cacheTable {
+    struct tableArray current;
+    struct tableArray previous;
+    size_t migrated;
+
+    // Changes which invalidate insert hints.
+    size_t generation;
+    size_t removals;
+};
+
+struct tablePosition {
+    struct tableArray *array;
+    size_t index;
+};
+
+// Shape of one or more tables, see tableStatsAdd.
+struct tableStats {
+    size_t capacity;
+    size_t size;
+    size_t tombstones;
+    // Items by the number of groups probed before the one holding them,
+    // the last count includes the longer probes.
+    size_t probeLengths[tableProbeLengths];
+    // Groups by the number of their full slots.
+    size_t groupOccupancy[tableGroupWidth + 1];
+};
+
+typedef void(*tableReleaseFn)(struct cacheItem *);
+
+/** Initialize an empty table
+ *
+ *  @param table The table.
+ *  @param capacity The expected number of items, the table grows as needed.
+ *  @return 0 in case of success
+ *          1 in case the allocation fails
+ */
+int tableInit(struct cacheTable *table, size_t capacity);
+
+/** Find the item with the given key
+ *
+ *  @param table The table.
+ *  @param hash The hash of the key.
+ *  @param key The key, not terminated by '\0'.
+ *  @param length The length of the key.
+ *  @param position The output parameter for the position of the item,
+ *                  may be NULL.
+ *  @param hint The output parameter for the insertion of the missing item,
+ *              may be NULL.
+ *  @return the item or NULL in case it is not present
+ */
+struct cacheItem *tableFind(struct cacheTable *table,
+                            size_t hash,
+                            const char *key,
+                            size_t length,
+                            struct tablePosition *position,
+                            struct insertHint *hint);
+
+/** Insert an item which is not present in the table
+ *
+ *  @param table The table.
+ *  @param item The item with the hash already set.
+ *  @param hint The hint left by tableFind for the same key, may be NULL.
+ *              It is ignored when the table changed too much since.
+ *  @return 0 in case of success
+ *          1 in case the allocation fails
+ */
+int tableInsert(struct cacheTable *table, struct cacheItem *item, const struct insertHint *hint);
+
+/** Check the hint left by tableFind
+ *
+ *  A valid hint also guarantees the key is still missing.
+ *
+ *  @param table The table.
+ *  @param hint The hint.
+ *  @return nonzero in case the hint can be used
+ */
+int tableHintValid(const struct cacheTable *table, const struct insertHint *hint);
+
+/** Remove the item found by tableFind
+ *
+ *  @param table The table.
+ *  @param position The position returned by tableFind.
+ *  @return the removed item
+ */
+struct cacheItem *tableRemove(struct cacheTable *table, const struct tablePosition *position);
+
+/** Number of items in the table.
+ *
+ *  @param table The table.
+ */
+size_t tableSize(const struct cacheTable *table);
+
+/** Add the shape of the table to the statistics
+ *
+ *  Walks all slots, long probes and crowded groups show clustered
+ *  hashes.
+ *
+ *  @param table The table.
+ *  @param stats The statistics the table is added to.
+ */
+void tableStatsAdd(const struct cacheTable *table, struct tableStats *stats);
+
+/** Remove all items and release the memory of the table.
+ *
+ *  @param table The table.
+ *  @param release The function called for every item, may be NULL.
+ */
+void tableClean(struct cacheTable *table, tableReleaseFn release);
+
+#endif
@@ -0,0 +1,130 @@
+#include <string.h>
+
+#include "cache-wheel.h"
+
+static const uint64_t slotMask = wheelSlots - 1;
+
+static void wheelLink(struct timerWheel *wheel, struct cacheItem *item, unsigned level, unsigned slot)
+{
+    struct cacheItem **head = &wheel->slots[level][slot];
+    item->wheelNext = *head;
+    if (*head) {
+        (*head)->wheelPrev = &item->wheelNext;
+    }
+    item->wheelPrev = head;
+    item->wheelSlot = level * wheelSlots + slot;
+    *head = item;
+    wheel->occupied[level] |= 1ull << slot;
+}
+
+// Items too far away are placed at the end of the last level.
+static void place(struct timerWheel *wheel, struct cacheItem *item)
+{
+    const uint64_t span = 1ull << (wheelBits * wheelLevels);
+
+    uint64_t expires = item->timeOfDeath;
+    if (expires < wheel->current) {
+        expires = wheel->current;
+    }
+    if (expires - wheel->current >= span) {
+        expires = wheel->current + span - 1;
+    }
+
+    unsigned level = 0;
+    while (level + 1 < wheelLevels && expires - wheel->current >= 1ull << (wheelBits * (level + 1))) {
+        ++level;
+    }
+    wheelLink(wheel, item, level, (expires >> (wheelBits * level)) & slotMask);
+}
+
+// Detaches the whole slot.
+static struct cacheItem *takeSlot(struct timerWheel *wheel, unsigned level, unsigned slot)
+{
+    struct cacheItem *list = wheel->slots[level][slot];
+    wheel->slots[level][slot] = NULL;
+    wheel->occupied[level] &= ~(1ull << slot);
+    return list;
+}
+
+static void cascade(struct timerWheel *wheel, unsigned level, unsigned slot)
+{
+    struct cacheItem *item = takeSlot(wheel, level, slot);
+    while (item) {
+        struct cacheItem *next = item->wheelNext;
+        place(wheel, item);
+        item = next;
+    }
+}
+
+void wheelInit(struct timerWheel *wheel, uint64_t now)
+{
+    memset(wheel, 0, sizeof(struct timerWheel));
+    wheel->current = now;
+}
+
+void wheelAdd(struct timerWheel *wheel, struct cacheItem *item)
+{
+    place(wheel, item);
+    ++wheel->count;
+}
+
+void wheelRemove(struct timerWheel *wheel, struct cacheItem *item)
+{
+    *item->wheelPrev = item->wheelNext;
+    if (item->wheelNext) {
+        item->wheelNext->wheelPrev = item->wheelPrev;
+    }
+    unsigned level = item->wheelSlot / wheelSlots;
+    unsigned slot = item->wheelSlot % wheelSlots;
+    if (!wheel->slots[level][slot]) {
+        wheel->occupied[level] &= ~(1ull << slot);
+    }
+    --wheel->count;
+}
+
+size_t wheelAdvance(struct timerWheel *wheel, uint64_t now, wheelExpireFn expire, void *context)
+{
+    size_t expired = 0;
+
+    while (wheel->current < now) {
+        if (!wheel->count) {
+            wheel->current = now;
+            break;
+        }
+
+        unsigned index = wheel->current & slotMask;
+        if (!index) {
+            for (unsigned level = 1; level < wheelLevels; ++level) {
+                unsigned slot = (wheel->current >> (wheelBits * level)) & slotMask;
+                cascade(wheel, level, slot);
+                if (slot) {
+                    break;
+                }
+            }
+        }
+
+        // Empty slots of the first level are skipped at once.
+        uint64_t pending = wheel->occupied[0] >> index;
+        if (!pending) {
+            uint64_t next = (wheel->current | slotMask) + 1;
+            wheel->current = next < now ? next : now;
+            continue;
+        }
+        uint64_t tick = wheel->current + __builtin_ctzll(pending);
+        if (tick >= now) {
+            wheel->current = now;
+            break;
+        }
+
+        struct cacheItem *item = takeSlot(wheel, 0, tick & slotMask);
+        wheel->current = tick + 1;
+        while (item) {
+            struct cacheItem *next = item->wheelNext;
+            --wheel->count;
+            ++expired;
+            expire(context, item);
+            item = next;
+        }
+    }
+    return expired;
+}
@@ -0,0 +1,63 @@
+#ifndef CACHE_WHEEL_H
+#define CACHE_WHEEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cache-table.h"
+
+enum {
+    wheelBits = 6,
+    wheelSlots = 1 << wheelBits,
+    wheelLevels = 4
+};
+
+// Hierarchical timer wheel of cache items, one tick is a millisecond.
+// Level L holds items expiring within 64^(L + 1) ticks, its slots are
+// moved one level down as the time reaches them. Items further away
+// wait in the last level and are placed again.
+struct timerWheel {
+    struct cacheItem *slots[wheelLevels][wheelSlots];
+    // Bit per nonempty slot, so idle time is skipped quickly.
+    uint64_t occupied[wheelLevels];
+    // The first tick not processed yet.
+    uint64_t current;
+    size_t count;
+};
+
+typedef void(*wheelExpireFn)(void *context, struct cacheItem *item);
+
+/** Initialize an empty wheel.
+ *
+ *  @param wheel The wheel.
+ *  @param now The current time.
+ */
+void wheelInit(struct timerWheel *wheel, uint64_t now);
+
+/** Schedule the item to expire at its timeOfDeath.
+ *
+ *  @param wheel The wheel.
+ *  @param item The item, not scheduled yet.
+ */
+void wheelAdd(struct timerWheel *wheel, struct cacheItem *item);
+
+/** Cancel the expiration of the item.
+ *
+ *  @param wheel The wheel.
+ *  @param item The scheduled item.
+ */
+void wheelRemove(struct timerWheel *wheel, struct cacheItem *item);
+
+/** Expire all items with timeOfDeath before now
+ *
+ *  The items are removed from the wheel before expire is called.
+ *
+ *  @param wheel The wheel.
+ *  @param now The current time.
+ *  @param expire The function called for every expired item.
+ *  @param context The first argument of expire.
+ *  @return the number of expired items
+ */
+size_t wheelAdvance(struct timerWheel *wheel, uint64_t now, wheelExpireFn expire, void *context);
+
+#endif
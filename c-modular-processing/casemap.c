@@ -0,0 +1,194 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "casemap.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define CASEMAP_X86 1
+#include <immintrin.h>
+#endif
+
+// Every kernel flips the 0x20 bit of the bytes in [first, last], which
+// maps 'a'-'z' to upper case and 'A'-'Z' to lower case.
+typedef void(*caseKernelFn)(char *out, const char *in, size_t length, char first, char last);
+
+static void scalarKernel(char *out, const char *in, size_t length, char first, char last)
+{
+    for (size_t i = 0; i < length; ++i) {
+        char c = in[i];
+        out[i] = c >= first && c <= last ? c ^ 0x20 : c;
+    }
+}
+
+static const uint64_t lsbs = 0x0101010101010101ull;
+static const uint64_t msbs = 0x8080808080808080ull;
+
+// Adding to the low 7 bits never carries into the next byte, bytes with
+// the top bit set are excluded by ~word.
+static uint64_t swarWord(uint64_t word, char first, char last)
+{
+    uint64_t low = word & ~msbs;
+    uint64_t aboveFirst = low + lsbs * (0x80 - first);
+    uint64_t aboveLast = low + lsbs * (0x80 - last - 1);
+    uint64_t inRange = aboveFirst & ~aboveLast & ~word & msbs;
+    return word ^ (inRange >> 2);
+}
+
+static void swarKernel(char *out, const char *in, size_t length, char first, char last)
+{
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= length; i += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, in + i, sizeof(word));
+        word = swarWord(word, first, last);
+        memcpy(out + i, &word, sizeof(word));
+    }
+    if (i < length) {
+        uint64_t word = 0;
+        memcpy(&word, in + i, length - i);
+        word = swarWord(word, first, last);
+        memcpy(out + i, &word, length - i);
+    }
+}
+
+#ifdef CASEMAP_X86
+
+// Signed comparison excludes bytes above 0x7F.
+__attribute__((target("sse2")))
+static __m128i sse2Block(__m128i block, __m128i below, __m128i above, __m128i flip)
+{
+    __m128i inRange = _mm_and_si128(_mm_cmpgt_epi8(block, below), _mm_cmplt_epi8(block, above));
+    return _mm_xor_si128(block, _mm_and_si128(inRange, flip));
+}
+
+__attribute__((target("sse2")))
+static void sse2Kernel(char *out, const char *in, size_t length, char first, char last)
+{
+    if (length < 16) {
+        swarKernel(out, in, length, first, last);
+        return;
+    }
+
+    const __m128i below = _mm_set1_epi8(first - 1);
+    const __m128i above = _mm_set1_epi8(last + 1);
+    const __m128i flip = _mm_set1_epi8(0x20);
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        __m128i block = _mm_loadu_si128((const __m128i *)(in + i));
+        _mm_storeu_si128((__m128i *)(out + i), sse2Block(block, below, above, flip));
+    }
+    // The last block overlaps the previous one, mapping twice is harmless.
+    if (i < length) {
+        i = length - 16;
+        __m128i block = _mm_loadu_si128((const __m128i *)(in + i));
+        _mm_storeu_si128((__m128i *)(out + i), sse2Block(block, below, above, flip));
+    }
+}
+
+__attribute__((target("avx2")))
+static __m256i avx2Block(__m256i block, __m256i below, __m256i above, __m256i flip)
+{
+    __m256i inRange = _mm256_and_si256(_mm256_cmpgt_epi8(block, below), _mm256_cmpgt_epi8(above, block));
+    return _mm256_xor_si256(block, _mm256_and_si256(inRange, flip));
+}
+
+__attribute__((target("avx2")))
+static void avx2Kernel(char *out, const char *in, size_t length, char first, char last)
+{
+    if (length < 32) {
+        sse2Kernel(out, in, length, first, last);
+        return;
+    }
+
+    const __m256i below = _mm256_set1_epi8(first - 1);
+    const __m256i above = _mm256_set1_epi8(last + 1);
+    const __m256i flip = _mm256_set1_epi8(0x20);
+    size_t i = 0;
+    for (; i + 32 <= length; i += 32) {
+        __m256i block = _mm256_loadu_si256((const __m256i *)(in + i));
+        _mm256_storeu_si256((__m256i *)(out + i), avx2Block(block, below, above, flip));
+    }
+    if (i < length) {
+        i = length - 32;
+        __m256i block = _mm256_loadu_si256((const __m256i *)(in + i));
+        _mm256_storeu_si256((__m256i *)(out + i), avx2Block(block, below, above, flip));
+    }
+}
+
+static int sse2Supported(void)
+{
+    return __builtin_cpu_supports("sse2");
+}
+
+static int avx2Supported(void)
+{
+    return __builtin_cpu_supports("avx2");
+}
+
+#endif
+
+static int alwaysSupported(void)
+{
+    return 1;
+}
+
+struct caseKernel {
+    const char *name;
+    caseKernelFn kernel;
+    int (*supported)(void);
+};
+
+// From the best one.
+static const struct caseKernel kernels[] = {
+#ifdef CASEMAP_X86
+    { "avx2", avx2Kernel, avx2Supported },
+    { "sse2", sse2Kernel, sse2Supported },
+#endif
+    { "swar", swarKernel, alwaysSupported },
+    { "scalar", scalarKernel, alwaysSupported }
+};
+
+static const struct caseKernel *selected;
+
+static const struct caseKernel *kernel(void)
+{
+    const struct caseKernel *current = __atomic_load_n(&selected, __ATOMIC_ACQUIRE);
+    if (!current) {
+        caseSelect(NULL);
+        current = __atomic_load_n(&selected, __ATOMIC_ACQUIRE);
+    }
+    return current;
+}
+
+int caseSelect(const char *name)
+{
+    for (size_t k = 0; k < sizeof(kernels) / sizeof(*kernels); ++k) {
+        if (name && strcmp(name, kernels[k].name)) {
+            continue;
+        }
+        if (!kernels[k].supported()) {
+            if (name) {
+                return 1;
+            }
+            continue;
+        }
+        __atomic_store_n(&selected, &kernels[k], __ATOMIC_RELEASE);
+        return 0;
+    }
+    return 1;
+}
+
+const char *caseSelected(void)
+{
+    return kernel()->name;
+}
+
+void caseToUpper(char *out, const char *in, size_t length)
+{
+    kernel()->kernel(out, in, length, 'a', 'z');
+}
+
+void caseToLower(char *out, const char *in, size_t length)
+{
+    kernel()->kernel(out, in, length, 'A', 'Z');
+}
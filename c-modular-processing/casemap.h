@@ -0,0 +1,39 @@
+#ifndef CASEMAP_H
+#define CASEMAP_H
+
+#include <stddef.h>
+
+// ASCII case mapping, other bytes are copied unchanged. The same as
+// toupper/tolower in the "C" locale the program runs in.
+
+/** Copy the bytes and map lower case letters to upper case
+ *
+ *  @param out The output, at least length bytes, may be the same as in.
+ *  @param in The input.
+ *  @param length The number of bytes.
+ */
+void caseToUpper(char *out, const char *in, size_t length);
+
+/** Copy the bytes and map upper case letters to lower case
+ *
+ *  @param out The output, at least length bytes, may be the same as in.
+ *  @param in The input.
+ *  @param length The number of bytes.
+ */
+void caseToLower(char *out, const char *in, size_t length);
+
+/** Select the kernel
+ *
+ *  The best kernel the CPU supports is selected on the first use,
+ *  other ones are meant for benchmarks.
+ *
+ *  @param name "scalar", "swar", "sse2", "avx2" or NULL for the best one.
+ *  @return 0 in case of success
+ *          1 in case the kernel is unknown or not supported by the CPU
+ */
+int caseSelect(const char *name);
+
+/** Name of the selected kernel. */
+const char *caseSelected(void);
+
+#endif
@@ -0,0 +1,52 @@
+#include <time.h>
+
+#include "clock.h"
+
+// Resolution of a few milliseconds, read without entering the kernel.
+#ifdef CLOCK_MONOTONIC_COARSE
+#define MONOTONIC_CLOCK CLOCK_MONOTONIC_COARSE
+#else
+#define MONOTONIC_CLOCK CLOCK_MONOTONIC
+#endif
+
+#ifdef CLOCK_REALTIME_COARSE
+#define WALL_CLOCK CLOCK_REALTIME_COARSE
+#else
+#define WALL_CLOCK CLOCK_REALTIME
+#endif
+
+// 0 until the first tick.
+static uint64_t now;
+static int64_t wall;
+
+static int64_t milliseconds(clockid_t id)
+{
+    struct timespec time;
+    clock_gettime(id, &time);
+    return (int64_t)time.tv_sec * 1000 + time.tv_nsec / 1000000;
+}
+
+void clockTick(void)
+{
+    // Starts at 1, so a sampled value is never 0.
+    __atomic_store_n(&now, (uint64_t)milliseconds(MONOTONIC_CLOCK) + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&wall, milliseconds(WALL_CLOCK), __ATOMIC_RELAXED);
+}
+
+uint64_t clockNow(void)
+{
+    uint64_t value = __atomic_load_n(&now, __ATOMIC_RELAXED);
+    if (!value) {
+        clockTick();
+        value = __atomic_load_n(&now, __ATOMIC_RELAXED);
+    }
+    return value;
+}
+
+int64_t clockWall(void)
+{
+    if (!__atomic_load_n(&now, __ATOMIC_RELAXED)) {
+        clockTick();
+    }
+    return __atomic_load_n(&wall, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,24 @@
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include <stdint.h>
+
+/** Sample the clocks
+ *
+ *  Called once per batch, so the time costs no system call per query.
+ *  Safe to call from several threads.
+ */
+void clockTick(void);
+
+/** Milliseconds of the coarse monotonic clock at the last tick.
+ *
+ *  Only differences of the values have a meaning.
+ */
+uint64_t clockNow(void);
+
+/** Milliseconds since the epoch at the last tick, for values which
+ *  outlive the process.
+ */
+int64_t clockWall(void);
+
+#endif
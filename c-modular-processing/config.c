@@ -1,512 +1,400 @@
+// MAP_ANONYMOUS is not part of POSIX.
+#define _DEFAULT_SOURCE
+
 #include "config.h"
+#include "hash.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <limits.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <ctype.h>
+#include <errno.h>
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
 #include <stdbool.h>
 
 
-void listInit(struct config *cfg)
+void configInit(struct config *cfg)
 {
     assert(cfg != NULL);
 
-    cfg->end = NULL;
-    cfg->head = NULL;
+    cfg->data = NULL;
+    cfg->size = 0;
+    cfg->mapped = 0;
+    cfg->index = NULL;
+    cfg->indexCapacity = 0;
+    cfg->indexCount = 0;
 }
 
 
-void memoryInit(char **values, unsigned int index)
+bool isPunctuation(const char character)
 {
-    for (unsigned int i = index; i < index + 10; i++) {
-        values[i] = NULL;
+    switch(character) {
+    case '-': return true;
+    case '_': return true;
+    case ':': return true;
+    default: return false;
     }
 }
 
 
-bool reallocate2D(char ***values, unsigned int *memory)
+// Index of the sections (with NULL owner) and of the keys of every
+// section. Built while parsing, so duplicates are found without comparing
+// all pairs and lookups take constant time. Names and values point into
+// the config data, a section is identified by its name.
+enum entryFlags {
+    EntryInteger = 1,
+    EntryBool = 2,
+    // The whole value is a number within int, without a sign.
+    EntryCount = 4,
+    EntrySize = 8
+};
+
+struct configEntry {
+    size_t hash;
+    const char *owner;
+    const char *name;
+    const char *value;
+    size_t valueLength;
+    // The value parsed once while reading, see entryFlags.
+    int integer;
+    int boolean;
+    size_t size;
+    unsigned flags;
+};
+
+
+size_t nameHash(const char *owner, const char *begin, const char *end)
 {
-    *values = (char**)realloc(*values, (*memory + *memory) * sizeof(char*));
-
-    if (!*values) {
-        return false;
-    }
-
-    memoryInit(*values, *memory);
-    *memory += *memory;
-    return true;
+    size_t mixed = (size_t)(uintptr_t)owner * (size_t)0x9E3779B97F4A7C15ull;
+    return hashBytes(begin, end - begin) ^ mixed;
 }
 
 
-bool configPush(struct config *cfg, char *name)
+// Every line adds at most one entry, so the index is allocated once
+// and stays at most half full.
+bool indexInit(struct config *cfg, size_t lines)
 {
-    assert(cfg != NULL);
-    assert(name != NULL);
-
-    struct section *sec = malloc(sizeof *sec);
-    if (!sec) return false;
-
-    sec->name = (char*)malloc(strlen(name) + 1);
-    if (!sec->name) return false;
-
-    strcpy(sec->name, name);
-
-    sec->keys = calloc(10, sizeof(char*));
-    if (!sec->keys) return false;
-
-    sec->values = calloc(10, sizeof(char*));
-    if (!sec->values) return false;
-
-    memoryInit(sec->keys, 0);
-    memoryInit(sec->values, 0);
-
-    if (!cfg->head) {
-        cfg->end = sec;
-        cfg->head = sec;
-        sec->prev = NULL;
-        sec->next = NULL;
-    } else {
-        sec->next = NULL;
-        sec->prev = cfg->end;
-        cfg->end->next = sec;
-        cfg->end = sec;
+    size_t capacity = 64;
+    while (capacity < 2 * lines) {
+        capacity *= 2;
     }
 
-    return true;
-}
-
-
-unsigned int startIndex(char *value)
-{
-    unsigned int start = 0;
-
-    for (unsigned int i = 0; i < strlen(value); i++) {
-        if (!isspace(value[i])) {
-            if (value[i] != '=') {
-                start = i;
-                break;
-            }
-        }
+    cfg->index = (struct configEntry*)calloc(capacity, sizeof(struct configEntry));
+    if (!cfg->index) {
+        return false;
     }
-
-    return start;
+    cfg->indexCapacity = capacity;
+    return true;
 }
 
 
-unsigned int endIndex(char *value)
+// The slot of the name or the empty slot where it belongs.
+size_t indexSlot(const struct config *cfg, const char *owner, const char *name, size_t hash)
 {
-    unsigned int end = strlen(value);
-
-    if (end == 1) {
-        return 1;
-    }
-
-    for (unsigned int i = end - 1; i > 0; i--) {
-        if (!isspace(value[i])) {
-            end = i + 1;
+    size_t slot = hash & (cfg->indexCapacity - 1);
+    while (cfg->index[slot].name) {
+        const struct configEntry *entry = &cfg->index[slot];
+        if (entry->hash == hash && entry->owner == owner && strcmp(entry->name, name) == 0) {
             break;
         }
+        slot = (slot + 1) & (cfg->indexCapacity - 1);
     }
-
-    return end;
+    return slot;
 }
 
 
-unsigned int findEqualCharacter(char *value)
+const struct configEntry *indexFind(const struct config *cfg, const char *owner, const char *name)
 {
-    for (unsigned int i = 0; i < strlen(value); i++) {
-        if (value[i] == '=') {
-            return i;
-        }
+    if (!cfg->indexCapacity) {
+        return NULL;
     }
 
-    return 0;
+    size_t hash = nameHash(owner, name, name + strlen(name));
+    const struct configEntry *entry = &cfg->index[indexSlot(cfg, owner, name, hash)];
+    return entry->name ? entry : NULL;
 }
 
 
-bool whiteSpaces(char *value)
+int cfgBoolString(const char *query)
 {
-    for (unsigned int i = 0; i < strlen(value); i++) {
-        if (!isspace(value[i])) {
-            return false;
-        }
+    if (strcmp(query, "true") == 0) {
+        return 1;
+    } else if (strcmp(query, "yes") == 0) {
+        return 1;
+    }  else if (strcmp(query, "false") == 0) {
+        return 0;
+    } else if (strcmp(query, "no") == 0) {
+        return 0;
+    } else {
+        return -1;
     }
-
-    return true;
 }
 
 
-bool configAddValue(struct section *sec,
-                    char *buffer,
-                    unsigned int index,
-                    unsigned int *memory)
+bool parseSize(const char *text, size_t *size)
 {
-    assert(sec != NULL);
-    assert(buffer != NULL);
-
-    if (index >= *memory) {
-        sec->keys = (char**)realloc(sec->keys, (*memory + *memory) * sizeof(char*));
-        sec->values = (char**)realloc(sec->values, (*memory + *memory) * sizeof(char*));
-
-        if (!sec->keys || !sec->values) {
-            return false;
-        }
-
-        memoryInit(sec->keys, *memory);
-        memoryInit(sec->values, *memory);
-        *memory += *memory;
+    // strtoull would accept a sign and negate the value.
+    if (!isdigit((unsigned char)*text)) {
+        return false;
     }
 
-    unsigned int equal = findEqualCharacter(buffer);
-    char *value = buffer + (equal + 1);
-
-    char *key = strtok(buffer, " \t\n\v\f\r=");
-    value = strtok(value, "\n");
-
-    if (key && !value) {
-        value = "";
-    } else if (whiteSpaces(value)) {
-        value = "";
-    } else {
-        value = value + startIndex(value);;
-        unsigned int end = endIndex(value);
-        value[end] = '\0';
+    char *end;
+    errno = 0;
+    unsigned long long value = strtoull(text, &end, 10);
+    if (errno == ERANGE) {
+        return false;
     }
 
-    sec->keys[index] = (char*)malloc(strlen(key) + 1);
-    sec->values[index] = (char*)malloc(strlen(value) + 1);
-
-    if (!sec->keys[index] || !sec->values[index]) {
+    int shift = 0;
+    switch (toupper((unsigned char)*end)) {
+    case 'G': shift = 30; ++end; break;
+    case 'M': shift = 20; ++end; break;
+    case 'K': shift = 10; ++end; break;
+    default: break;
+    }
+    if (*end || value > (unsigned long long)SIZE_MAX >> shift) {
         return false;
     }
-
-    strcpy(sec->keys[index], key);
-    strcpy(sec->values[index], value);
+    *size = (size_t)(value << shift);
     return true;
 }
 
 
-char *readLine(FILE *file)
+void parseEntry(struct configEntry *entry)
 {
-    char *buffer = NULL;
-    int   size   = 0;
-    int   incr   = 63;
-
-    do {
-        char *tmp = realloc(buffer, size + incr + 1);
-
-        if (!tmp) {
-            free(buffer);
-            return NULL;
-        }
-
-        buffer = tmp;
-        if (!fgets(buffer + size, incr + 1, file)) {
-            free(buffer);
-            return NULL;
-        }
-
-        size += incr;
-    } while (!strchr(buffer + (size - incr), '\n'));
+    char *end;
+    errno = 0;
+    long number = strtol(entry->value, &end, 10);
+    entry->integer = number;
+    if (end != entry->value) {
+        entry->flags |= EntryInteger;
+    }
+    if (isdigit((unsigned char)*entry->value) && !*end && errno != ERANGE && number <= INT_MAX) {
+        entry->flags |= EntryCount;
+    }
+    if (parseSize(entry->value, &entry->size)) {
+        entry->flags |= EntrySize;
+    }
 
-    return buffer;
+    entry->boolean = cfgBoolString(entry->value);
+    if (entry->boolean == 0 || entry->boolean == 1) {
+        entry->flags |= EntryBool;
+    } else if ((entry->flags & EntryInteger) && (entry->integer == 0 || entry->integer == 1)) {
+        entry->boolean = entry->integer;
+        entry->flags |= EntryBool;
+    }
 }
 
 
-bool commentLine(const char character)
+/** Add a section (with NULL owner and value) or a key to the index
+ *
+ *  @return 0 in case the name was added
+ *          2 in case the owner has the name already
+ */
+int indexInsert(struct config *cfg, const char *owner,
+                const char *name, const char *nameEnd,
+                const char *value, const char *valueEnd)
 {
-    return (character == ';') ? true : false;
-}
-
+    assert(2 * (cfg->indexCount + 1) <= cfg->indexCapacity);
 
-bool unusedLine(const char *line)
-{
-    if (commentLine(line[0])) {
-        return true;
+    size_t hash = nameHash(owner, name, nameEnd);
+    struct configEntry *entry = &cfg->index[indexSlot(cfg, owner, name, hash)];
+    if (entry->name) {
+        return 2;
     }
 
-    for (unsigned int i = 0; i < strlen(line); i++) {
-        if (!isspace(line[i])) {
-            return false;
-        }
+    entry->hash = hash;
+    entry->owner = owner;
+    entry->name = name;
+    if (owner) {
+        entry->value = value;
+        entry->valueLength = valueEnd - value;
+        parseEntry(entry);
     }
-
-    return true;
-}
-
-
-bool checkFirstSquareBracket(const char character)
-{
-    return (character == '[') ? true : false;
+    ++cfg->indexCount;
+    return 0;
 }
 
 
-bool checkSecondSquareBracket(const char *line, unsigned int *end)
+const char *skipSpaces(const char *begin, const char *end)
 {
-    unsigned int length = strlen(line);
-
-    for (unsigned int j = length - 1; j > 0; j--) {
-        if (!isspace(line[j])) {
-            if (line[j] == ']') {
-                *end = j;
-                return true;
-            } else {
-                break;
-            }
-        }
+    while (begin < end && isspace((unsigned char)*begin)) {
+        begin++;
     }
-
-    return false;
+    return begin;
 }
 
 
-bool isPunctuation(const char character)
+const char *trimSpaces(const char *begin, const char *end)
 {
-    switch(character) {
-    case '-': return true;
-    case '_': return true;
-    case ':': return true;
-    default: return false;
+    while (end > begin && isspace((unsigned char)end[-1])) {
+        end--;
     }
+    return end;
 }
 
 
-bool checkSection(const char *line)
+// The name between the brackets, letters, digits and -_: only.
+bool sectionName(const char *line, const char *end, const char **name, const char **nameEnd)
 {
-    unsigned int end = 0;
-    unsigned int start = 0;
-
-    if (!checkFirstSquareBracket(line[0])) {
+    if (line == end || *line != '[') {
         return false;
     }
 
-    if (!checkSecondSquareBracket(line, &end)) {
+    end = trimSpaces(line, end);
+    if (end - line < 2 || end[-1] != ']') {
         return false;
     }
 
-    if (strlen(line) == 3) {
+    *name = skipSpaces(line + 1, end - 1);
+    *nameEnd = trimSpaces(*name, end - 1);
+    if (*name == *nameEnd) {
         return false;
     }
 
-    for (unsigned int i = 1; i < end; i++) {
-        if (!isspace(line[i])) {
-            start = i;
-            break;
-        }
-    }
-
-    for (unsigned int i = end - 1; i > 0; i--) {
-        if (!isspace(line[i])) {
-            end = i;
-            break;
+    for (const char *c = *name; c < *nameEnd; c++) {
+        if (!(isalnum((unsigned char)*c) || isPunctuation(*c))) {
+            return false;
         }
     }
 
-    for (unsigned int i = start; i < end + 1; i++) {
-        if (!(isalpha(line[i]) || isPunctuation(line[i]))) {
-            if (!isdigit(line[i])) {
-                return false;
-            }
-        }
-   }
-
     return true;
 }
 
 
-bool checkKeyValue(const char *line)
+// The key consists of letters and digits, leading white spaces and '='
+// of the value are skipped.
+bool keyValue(const char *line, const char *end,
+              const char **key, const char **keyEnd,
+              const char **value, const char **valueEnd)
 {
-    unsigned int equal = 0;
-    unsigned int start = 0, end = 0;
-
-    for (unsigned int i = 0; i < strlen(line); i++) {
-        if (line[i] == '=') {
-            equal = i;
-            break;
-        }
-    }
-
+    const char *equal = memchr(line, '=', end - line);
     if (!equal) {
         return false;
     }
 
-    for (unsigned int i = 0; i < equal; i++) {
-        if (!isspace(line[i])) {
-            start = i;
-            break;
-        }
-    }
-
-    for (unsigned int i = equal - 1; i > start; i--) {
-        if (!isspace(line[i])) {
-            end = i;
-            break;
-        }
+    *key = skipSpaces(line, equal);
+    *keyEnd = trimSpaces(*key, equal);
+    if (*key == *keyEnd) {
+        return false;
     }
 
-    for (unsigned int i = start; i < end + 1; i++) {
-        if (!(isdigit(line[i]) || isalpha(line[i]))) {
+    for (const char *c = *key; c < *keyEnd; c++) {
+        if (!isalnum((unsigned char)*c)) {
             return false;
         }
     }
 
+    *value = equal + 1;
+    while (*value < end && (isspace((unsigned char)**value) || **value == '=')) {
+        (*value)++;
+    }
+    *valueEnd = trimSpaces(*value, end);
     return true;
 }
 
 
-void cleanValues(char **values)
+char *readFile(FILE *file, size_t *size)
 {
-    for (unsigned int i = 0; values[i] != NULL; i++) {
-        free(values[i]);
+    size_t capacity = 4096;
+    if (fseek(file, 0, SEEK_END) == 0) {
+        long length = ftell(file);
+        if (length > 0) {
+            capacity = (size_t)length + 1;
+        }
+        rewind(file);
     }
 
-    free(values);
-}
-
-
-void cleanBufferKeys(char **values, unsigned int size)
-{
-    for (unsigned int i = 0; i < size; i++) {
-        free(values[i]);
+    char *data = (char*)malloc(capacity + 1);
+    size_t length = 0;
+    while (data) {
+        length += fread(data + length, 1, capacity - length, file);
+        if (length < capacity) {
+            break;
+        }
+        capacity *= 2;
+        char *tmp = (char*)realloc(data, capacity + 1);
+        if (!tmp) {
+            free(data);
+        }
+        data = tmp;
     }
-}
-
-
-bool searchDuplicitySections(char **sections, char *last, unsigned int index)
-{
-    char *tokenLast = strtok(last, " \t\n\v\f\r[]");
-
-    for(unsigned int i = 0; i < index; i++) {
-        char *tokenElement = strtok(sections[i], " \t\n\v\f\r[]");
 
-        if (strcmp(tokenElement, tokenLast) == 0) {
-            return true;
-        }
+    if (!data || ferror(file)) {
+        free(data);
+        return NULL;
     }
 
-    return false;
+    data[length] = '\0';
+    *size = length;
+    return data;
 }
 
 
-bool searchDuplicityKeys(char **keys, char *last, unsigned int index)
+// A private writable mapping of the file followed by at least one zero
+// byte, so the last value is terminated even when the file ends at a page
+// boundary. Both mappings are released by a single munmap.
+char *mapFile(int fd, size_t size)
 {
-    char *tokenLast = strtok(last, " \t\n\v\f\r=");
-
-    for(unsigned int i = 0; i < index; i++) {
-        char *tokenElement = strtok(keys[i], " \t\n\v\f\r=");
+    char *data = mmap(NULL, size + 1, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (data == MAP_FAILED) {
+        return NULL;
+    }
 
-        if (strcmp(tokenElement, tokenLast) == 0) {
-            return true;
-        }
+    if (mmap(data, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        munmap(data, size + 1);
+        return NULL;
     }
 
-    return false;
+    posix_madvise(data, size, POSIX_MADV_SEQUENTIAL);
+    return data;
 }
 
 
-bool validFile(FILE *file)
+// Names and values are terminated in place, the character after each
+// of them is a white space, a bracket, '=' or the end of the data.
+int parseConfig(struct config *cfg, char *data, size_t size)
 {
-    char **sections = (char**)calloc(10, sizeof(char*));
-    char **keys = (char**)calloc(10, sizeof(char*));
+    int rv = 0;
+    const char *section = NULL;
 
-    if (!sections || !keys) {
-        return false;
+    char *end = data + size;
+    size_t lines = 1;
+    for (const char *c = data; (c = memchr(c, '\n', end - c)); c++) {
+        lines++;
+    }
+    if (!indexInit(cfg, lines)) {
+        return 1;
     }
 
-    memoryInit(sections, 0);
-
-    unsigned int memorySections = 10, memoryKeys = 10;
-    unsigned int indexSections = 0, indexKeys = 0;
-
-    bool firstSectionIndicator = false;
-    bool newSectionIndicator = false;
-
-    char *buffer = readLine(file);
-
-    while (buffer != NULL) {
-        if (!unusedLine(buffer)) {
-            // Check if section is valid
-            if (checkSection(buffer)) {
-                firstSectionIndicator = true;
-                newSectionIndicator = true;
-                if (indexSections >= memorySections) {
-                    if (!reallocate2D(&sections, &memorySections)) {
-                        cleanValues(sections);
-                        cleanValues(keys);
-                        free(buffer);
-                        return false;
-                    }
-                }
-                sections[indexSections] = (char*)calloc(strlen(buffer) + 1, sizeof(char));
-                if (!sections[indexSections]) {
-                    cleanValues(sections);
-                    cleanValues(keys);
-                    free(buffer);
-                    return false;
-                }
-                strcpy(sections[indexSections], buffer);
-                if (searchDuplicitySections(sections, buffer, indexSections)) {
-                    cleanValues(sections);
-                    cleanValues(keys);
-                    free(buffer);
-                    return false;
-                }
-                indexSections++;
-            }
-            // Check if keys and values are valid
-            else if (checkKeyValue(buffer)) {
-                if (!firstSectionIndicator) {
-                    cleanValues(sections);
-                    cleanValues(keys);
-                    free(buffer);
-                    return false;
-                }
-                if (newSectionIndicator) {
-                    newSectionIndicator = false;
-                    cleanBufferKeys(keys, indexKeys);
-                    memoryInit(keys, 0);
-                    memoryKeys = 10;
-                    indexKeys = 0;
-                }
-                if (indexKeys >= memoryKeys) {
-                    if (!reallocate2D(&keys, &memoryKeys)) {
-                        cleanValues(sections);
-                        cleanValues(keys);
-                        free(buffer);
-                        return false;
-                    }
-                }
-                keys[indexKeys] = (char*)calloc(strlen(buffer) + 1, sizeof(char));
-                if (!keys[indexKeys]) {
-                    cleanValues(sections);
-                    cleanValues(keys);
-                    free(buffer);
-                    return false;
-                }
-                strcpy(keys[indexKeys], buffer);
-                if (searchDuplicityKeys(keys, buffer, indexKeys)) {
-                    cleanValues(sections);
-                    cleanValues(keys);
-                    free(buffer);
-                    return false;
-                }
-                indexKeys++;
-            }
-            else {
-                cleanValues(sections);
-                cleanValues(keys);
-                free(buffer);
-                return false;
-            }
+    for (char *line = data; line < end && !rv; ) {
+        char *lineEnd = memchr(line, '\n', end - line);
+        if (!lineEnd) {
+            lineEnd = end;
         }
 
-        free(buffer);
-        buffer = readLine(file);
+        const char *name, *nameEnd, *key, *keyEnd, *value, *valueEnd;
+        if (*line == ';' || skipSpaces(line, lineEnd) == lineEnd) {
+            // Comments start at the beginning of the line.
+        } else if (sectionName(line, lineEnd, &name, &nameEnd)) {
+            data[nameEnd - data] = '\0';
+            rv = indexInsert(cfg, NULL, name, nameEnd, NULL, NULL);
+            section = name;
+        } else if (keyValue(line, lineEnd, &key, &keyEnd, &value, &valueEnd) && section) {
+            data[keyEnd - data] = '\0';
+            data[valueEnd - data] = '\0';
+            rv = indexInsert(cfg, section, key, keyEnd, value, valueEnd);
+        } else {
+            rv = 2;
+        }
+
+        line = lineEnd + 1;
     }
 
-    cleanValues(sections);
-    cleanValues(keys);
-    return true;
+    return rv;
 }
 
 
@@ -515,7 +403,7 @@ int configRead(struct config *cfg, const char *name)
     assert(name != NULL);
     assert(cfg != NULL);
 
-    listInit(cfg);
+    configInit(cfg);
 
     FILE* configFile = fopen(name, "r");
 
@@ -523,72 +411,28 @@ int configRead(struct config *cfg, const char *name)
         return 1;
     }
 
-    if (!validFile(configFile)) {
-        fclose(configFile);
-        return 2;
+    // Regular files are parsed in a mapping, anything else is read.
+    struct stat info;
+    if (!fstat(fileno(configFile), &info) && S_ISREG(info.st_mode) && info.st_size > 0) {
+        cfg->data = mapFile(fileno(configFile), info.st_size);
+        cfg->size = info.st_size;
+        cfg->mapped = cfg->data != NULL;
     }
-
-    fseek(configFile, 0, SEEK_SET);
-
-    unsigned int index = 0;
-    unsigned int memory = 10;
-
-    char *buffer = readLine(configFile);
-
-    while (buffer != NULL) {
-        if (!unusedLine(buffer)) {
-            if (checkFirstSquareBracket(buffer[0])) {
-                char *name = strtok(buffer, " \t\n\v\f\r[]");
-                if (!configPush(cfg, name)) {
-                    free(buffer);
-                    fclose(configFile);
-                    return 1;
-                }
-                index = 0;
-                memory = 10;
-            } else {
-                if (!configAddValue(cfg->end, buffer, index, &memory)) {
-                    free(buffer);
-                    fclose(configFile);
-                    return 1;
-                }
-                index++;
-            }
-        }
-        free(buffer);
-        buffer = readLine(configFile);
+    if (!cfg->data) {
+        cfg->data = readFile(configFile, &cfg->size);
     }
-
     fclose(configFile);
-    return 0;
-}
-
-
-bool findKey(char **keys, const char *seek, unsigned int *index)
-{
-    for (unsigned int i = 0; keys[i] != NULL; i++) {
-        if (strcmp(keys[i], seek) == 0) {
-            return true;
-        }
-        (*index)++;
+    if (!cfg->data) {
+        return 1;
     }
-    return false;
-}
 
+    int rv = parseConfig(cfg, cfg->data, cfg->size);
 
-int cfgBoolString(char *query)
-{
-    if (strcmp(query, "true") == 0) {
-        return 1;
-    } else if (strcmp(query, "yes") == 0) {
-        return 1;
-    }  else if (strcmp(query, "false") == 0) {
-        return 0;
-    } else if (strcmp(query, "no") == 0) {
-        return 0;
-    } else {
-        return -1;
+    // A broken config is not used partially.
+    if (rv) {
+        configClean(cfg);
     }
+    return rv;
 }
 
 
@@ -600,83 +444,88 @@ int configValue(const struct config *cfg,
 {
     assert(cfg != NULL);
     assert(key != NULL);
-    assert(section != NULL);    // co configValueType?
-
-    struct section *current = cfg->head;
-
-    unsigned int index = 0;
-    bool isSection = false;
-
-    while (current != NULL && isSection != true) {
-        if (strcmp(current->name, section) == 0) {
-            isSection = true;
-            if (findKey(current->keys, key, &index)) {
-                char *valueFromCfg = current->values[index], *buffer;
-                int resultInteger = -1, *result = &resultInteger;
-                switch(type) {
-                case CfgString:
-                    if (valueFromCfg == NULL) {
-                        return 3;
-                    }
-                    *((const char**)value) = valueFromCfg;
-                    return 0;
-                case CfgInteger:
-                    resultInteger = strtol(valueFromCfg, &buffer, 10);
-                    if (valueFromCfg == buffer) {
-                        return 3;
-                    }
-                    if (*result == 1 || *result == 0) {
-                        return 3;
-                    }
-                    *((int*)value) = *result;
-                    return 0;
-                case CfgBool:
-                    resultInteger = cfgBoolString(valueFromCfg);
-                    if (resultInteger == 0 || resultInteger == 1) {
-                        *((int*)value) = *result;
-                        return 0;
-                    }
-                    resultInteger = strtol(valueFromCfg, &buffer, 10);
-                    if (valueFromCfg == buffer) {
-                        return 3;
-                    }
-                    if (!(*result == 1 || *result == 0)) {
-                        return 3;
-                    }
-                    *((int*)value) = *result;
-                    return 0;
-                default:
-                    return 4;
-                }
-            }
-        }
-        current = current->next;
-    }
+    assert(section != NULL);
 
-    if (!isSection) {
+    const struct configEntry *sectionEntry = indexFind(cfg, NULL, section);
+    if (!sectionEntry) {
         return 1;
     }
 
-    return 2;
+    const struct configEntry *entry = indexFind(cfg, sectionEntry->name, key);
+    if (!entry) {
+        return 2;
+    }
+
+    switch(type) {
+    case CfgString:
+        *((const char**)value) = entry->value;
+        return 0;
+    case CfgView:
+        ((struct configView*)value)->data = entry->value;
+        ((struct configView*)value)->length = entry->valueLength;
+        return 0;
+    case CfgInteger:
+        if (!(entry->flags & EntryInteger)) {
+            return 3;
+        }
+        if (entry->integer == 1 || entry->integer == 0) {
+            return 3;
+        }
+        *((int*)value) = entry->integer;
+        return 0;
+    case CfgCount:
+        if (!(entry->flags & EntryCount)) {
+            return 3;
+        }
+        *((int*)value) = entry->integer;
+        return 0;
+    case CfgBool:
+        if (!(entry->flags & EntryBool)) {
+            return 3;
+        }
+        *((int*)value) = entry->boolean;
+        return 0;
+    case CfgSize:
+        if (!(entry->flags & EntrySize)) {
+            return 3;
+        }
+        *((size_t*)value) = entry->size;
+        return 0;
+    default:
+        return 4;
+    }
 }
 
 
-void configClean(struct config *cfg)
+int configFields(const struct config *cfg,
+                 const char *section,
+                 struct configField *fields,
+                 size_t count)
 {
-    if (cfg->head && cfg->end) {
-        struct section *next = NULL;
-        struct section *current = cfg->head;
-
-        while (current != NULL) {
-            next = current->next;
-            free(current->name);
-            cleanValues(current->keys);
-            cleanValues(current->values);
-            free(current);
-            current = next;
+    int invalid = 0;
+    for (size_t i = 0; i < count; i++) {
+        fields[i].status = configValue(cfg, section, fields[i].key, fields[i].type, fields[i].value);
+        if (fields[i].status == 3) {
+            invalid++;
         }
+    }
+    return invalid;
+}
+
 
-        cfg->head = NULL;
-        cfg->end = NULL;
+void configClean(struct config *cfg)
+{
+    if (cfg->mapped) {
+        munmap(cfg->data, cfg->size + 1);
+    } else {
+        free(cfg->data);
     }
+    cfg->data = NULL;
+    cfg->size = 0;
+    cfg->mapped = 0;
+
+    free(cfg->index);
+    cfg->index = NULL;
+    cfg->indexCapacity = 0;
+    cfg->indexCount = 0;
 }
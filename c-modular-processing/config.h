@@ -1,28 +1,59 @@
 #ifndef CONFIG_H
 #define CONFIG_H
 
+#include <stddef.h>
+
 enum configValueType {
     // From the first non-white character up to the last one on the line.
     CfgString,
     // Only valid number can be considered.
     CfgInteger,
+    // A whole number from 0 to INT_MAX as int, digits only. Unlike
+    // CfgInteger, 0 and 1 are accepted.
+    CfgCount,
     // All of {1, "true", "yes"} should be accepted as true.
     // All of {0, "false", "no"} should be accepted as false.
-    CfgBool
+    CfgBool,
+    // Number of bytes as size_t, may end with K, M or G.
+    CfgSize,
+    // The string as struct configView, without looking for its end.
+    CfgView
 };
 
-struct section {
-    char *name;
-    char **keys;
-    char **values;
-    struct section *next, *prev;
-};
+struct configEntry;
 
 struct config {
-    struct section *head, *end;
+    // Private copy of the file, names and values are terminated in place.
+    char *data;
+    size_t size;
+    // The data is a mapping of the file rather than a heap buffer.
+    int mapped;
+    // Hash index of the sections and their keys, built by configRead.
+    struct configEntry *index;
+    size_t indexCapacity;
+    size_t indexCount;
+};
+
+// A value as it is in the file, valid until configClean.
+struct configView {
+    const char *data;
+    size_t length;
+};
+
+// One value of a schema read by configFields.
+struct configField {
+    const char *key;
+    enum configValueType type;
+    // Set only in case the value is valid, so it may hold the default.
+    void *value;
+    // The result of configValue.
+    int status;
 };
 
 /** Read the config file
+ *
+ *  Regular files are mapped and parsed in place, names and values
+ *  point into the mapping, so the only allocation is the index.
  *
  *  @param cfg The config structure.
  *  @param name The path to the config file.
@@ -51,6 +82,24 @@ int configValue(const struct config *cfg,
                 enum configValueType type,
                 void *value);
 
+/** Read several values of a section at once
+ *
+ *  Values are parsed when the config is read, so this costs
+ *  a hash lookup per field.
+ *
+ *  @param cfg The config structure.
+ *  @param section The section of the config file.
+ *  @param fields The keys, their types and the output parameters,
+ *                the status of every field is set.
+ *  @param count The number of fields.
+ *  @return the number of fields whose value cannot be converted
+ *          into the desired type
+ */
+int configFields(const struct config *cfg,
+                 const char *section,
+                 struct configField *fields,
+                 size_t count);
+
 /** Release all resources hold by Config structure. 
  *
  *  @param cfg The config structure.
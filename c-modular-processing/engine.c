@@ -0,0 +1,603 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "clock.h"
+#include "engine.h"
+#include "log.h"
+#include "stats.h"
+
+enum {
+    slotsPerThread = 2,
+    // Shorter pieces of the output are copied, longer ones are
+    // written from where they are.
+    outputCopyLimit = 256
+};
+
+enum slotState {
+    SlotFree,
+    SlotReady,
+    SlotBusy,
+    SlotDone
+};
+
+struct slot {
+    // Queries view the input directly; lines that had to be copied are
+    // stored in data and their views are set when the slot is published.
+    struct batch batch;
+    size_t *offsets;
+    unsigned char *skip;
+
+    char *data;
+    size_t dataLength;
+    size_t dataCapacity;
+
+    // The output is written by writev. An iovec with a NULL base
+    // stands for the next bytes copied into output. Pieces of a line
+    // start at the previous line end.
+    struct iovec *pieces;
+    size_t pieceCount;
+    size_t pieceCapacity;
+    size_t *lineEnds;
+    size_t lineCount;
+    char *output;
+    size_t outputLength;
+    size_t outputCapacity;
+    // Set when the output of a line cannot be stored. The lines before
+    // it are still written.
+    int failed;
+
+    enum slotState state;
+};
+
+struct engine {
+    const struct pipeline *pipeline;
+    int ordered;
+    size_t batchSize;
+
+    // Ring of slots; a batch with sequence number s lives in
+    // slots[s % slotCount]. Batches in [head, claim) are being processed
+    // or waiting to be written, [claim, tail) wait for a worker.
+    struct slot *slots;
+    size_t slotCount;
+    size_t head;
+    size_t claim;
+    size_t tail;
+    int stop;
+
+    pthread_mutex_t lock;
+    pthread_cond_t workReady;
+    pthread_cond_t slotDone;
+    pthread_mutex_t outputLock;
+    struct writer *writer;
+    enum writerFlush flush;
+
+    // NULL in case the statistics are not collected.
+    struct stats *stats;
+
+    pthread_t *workers;
+    int workerCount;
+
+    // Set by the submitting thread when a slot failed, no more lines
+    // are accepted then.
+    int failed;
+};
+
+static int reserve(char **buffer, size_t *capacity, size_t needed)
+{
+    if (needed <= *capacity) {
+        return 0;
+    }
+    size_t size = *capacity ? *capacity : 256;
+    while (size < needed) {
+        size *= 2;
+    }
+    char *tmp = (char *)realloc(*buffer, size);
+    if (!tmp) {
+        LOG(LFatal, "Allocation failed (%zu bytes)", size);
+        return 1;
+    }
+    *buffer = tmp;
+    *capacity = size;
+    return 0;
+}
+
+static int appendPiece(struct slot *slot, const char *text, size_t length)
+{
+    if (slot->pieceCount == slot->pieceCapacity) {
+        size_t capacity = slot->pieceCapacity ? 2 * slot->pieceCapacity : 64;
+        struct iovec *pieces = (struct iovec *)realloc(slot->pieces, capacity * sizeof(struct iovec));
+        if (!pieces) {
+            LOG(LFatal, "Allocation failed (%zu bytes)", capacity * sizeof(struct iovec));
+            return 1;
+        }
+        slot->pieces = pieces;
+        slot->pieceCapacity = capacity;
+    }
+    slot->pieces[slot->pieceCount].iov_base = (void *)text;
+    slot->pieces[slot->pieceCount].iov_len = length;
+    ++slot->pieceCount;
+    return 0;
+}
+
+// The text must stay valid until the slot is reset.
+static int appendOutputN(struct slot *slot, const char *text, size_t length)
+{
+    if (!length) {
+        return 0;
+    }
+    if (length >= outputCopyLimit) {
+        return appendPiece(slot, text, length);
+    }
+
+    if (reserve(&slot->output, &slot->outputCapacity, slot->outputLength + length)) {
+        return 1;
+    }
+    memcpy(slot->output + slot->outputLength, text, length);
+    slot->outputLength += length;
+
+    // Pieces of different lines are not merged, so lines can be
+    // written one by one.
+    size_t lineStart = slot->lineCount ? slot->lineEnds[slot->lineCount - 1] : 0;
+    struct iovec *last = slot->pieceCount > lineStart ? &slot->pieces[slot->pieceCount - 1] : NULL;
+    if (last && !last->iov_base) {
+        last->iov_len += length;
+        return 0;
+    }
+    return appendPiece(slot, NULL, length);
+}
+
+static int appendOutput(struct slot *slot, const char *text)
+{
+    return appendOutputN(slot, text, strlen(text));
+}
+
+static void logResponse(const struct query *query)
+{
+    switch (query->responseCode) {
+    case RCSuccess:
+        LOG(LInfo, "Response success");
+        break;
+    case RCDone:
+        LOG(LInfo, "Response done");
+        break;
+    case RCError:
+        LOG(LError, "Error");
+        break;
+    default:
+        LOG(LError, "Error");
+        break;
+    }
+}
+
+static void runStage(struct module *module,
+                     struct batch *batch,
+                     processFn process,
+                     processBatchFn processBatch,
+                     struct stats *stats,
+                     int stage)
+{
+    if (processBatch && stats) {
+        uint64_t start = statsClock();
+        processBatch(module, batch);
+        statsBatch(stats, stage, batch, statsClock() - start);
+    } else if (processBatch) {
+        processBatch(module, batch);
+    } else if (stats) {
+        for (size_t i = 0; i < batch->count; ++i) {
+            if (!batchSkips(batch, i)) {
+                uint64_t start = statsClock();
+                process(module, &batch->queries[i]);
+                statsQuery(stats, stage, batch->queries[i].responseCode, statsClock() - start);
+            }
+        }
+    } else {
+        for (size_t i = 0; i < batch->count; ++i) {
+            if (!batchSkips(batch, i)) {
+                process(module, &batch->queries[i]);
+            }
+        }
+    }
+
+    for (size_t i = 0; i < batch->count; ++i) {
+        if (!batchSkips(batch, i)) {
+            logResponse(&batch->queries[i]);
+        }
+    }
+}
+
+static const char *orEmpty(const char *text)
+{
+    return text ? text : "";
+}
+
+static int finish(struct slot *slot, struct query *query)
+{
+    LOG(LInfo, "response: %.*s%.*s%.*s",
+        (int)query->responsePrefixLength, orEmpty(query->responsePrefix),
+        (int)query->responseLength, orEmpty(query->response),
+        (int)query->responseSuffixLength, orEmpty(query->responseSuffix));
+    char *status = NULL;
+
+    if (query->responseCode == RCSuccess) {
+        status = "\nresponse: SUCCES\nstatus: ";
+    } else if (query->responseCode == RCDone) {
+        status = "\nresponse: DONE\nstatus: ";
+    } else if (query->responseCode == RCError) {
+        status = "\nresponse: ERROR\nstatus: ";
+    } else {
+        status = "\nresponse: UNKNOWN\nstatus: ";
+    }
+
+    return appendOutput(slot, "query: ")
+        || appendOutputN(slot, query->query, query->queryLength)
+        || appendOutput(slot, status)
+        || appendOutputN(slot, query->responsePrefix, query->responsePrefixLength)
+        || appendOutputN(slot, query->response, query->responseLength)
+        || appendOutputN(slot, query->responseSuffix, query->responseSuffixLength)
+        || appendOutput(slot, "\n");
+}
+
+static void process(struct engine *engine, struct slot *slot)
+{
+    const struct pipeline *pipeline = engine->pipeline;
+    struct batch *batch = &slot->batch;
+
+    clockTick();
+    for (size_t i = 0; LOG_ENABLED(LInfo) && i < batch->count; ++i) {
+        LOG(LInfo, "query: %.*s", (int)batch->queries[i].queryLength, batch->queries[i].query);
+    }
+
+    batch->skip = NULL;
+    for (int m = 0; m < pipeline->preSize; ++m) {
+        struct module *module = &pipeline->pre[m];
+        LOG(LDebug, "Running module %s", module->name);
+        runStage(module, batch, module->process, module->processBatch, engine->stats, m);
+    }
+
+    // Only the queries which succeeded are postprocessed.
+    int postProcess = 0;
+    for (size_t i = 0; i < batch->count; ++i) {
+        LOG(LDebug, "responseCode: %i", batch->queries[i].responseCode);
+        slot->skip[i] = batch->queries[i].responseCode != RCSuccess;
+        postProcess |= !slot->skip[i];
+    }
+
+    batch->skip = slot->skip;
+    for (int m = 0; postProcess && m < pipeline->postSize; ++m) {
+        struct module *module = &pipeline->post[m];
+        LOG(LDebug, "Postprocessing by %s", module->name);
+        if (module->postProcess || module->postProcessBatch) {
+            runStage(module, batch, module->postProcess, module->postProcessBatch,
+                     engine->stats, pipeline->preSize + m);
+        }
+    }
+    batch->skip = NULL;
+
+    // The output refers to the queries, they are released by resetSlot.
+    for (size_t i = 0; i < batch->count; ++i) {
+        if (finish(slot, &batch->queries[i])) {
+            // Drops the pieces of the unfinished line.
+            slot->pieceCount = slot->lineCount ? slot->lineEnds[slot->lineCount - 1] : 0;
+            slot->failed = 1;
+            break;
+        }
+        slot->lineEnds[slot->lineCount++] = slot->pieceCount;
+    }
+
+    if (engine->stats) {
+        statsPoll(engine->stats);
+    }
+}
+
+static void writeSlot(struct engine *engine, struct slot *slot)
+{
+    char *copied = slot->output;
+    for (size_t i = 0; i < slot->pieceCount; ++i) {
+        if (!slot->pieces[i].iov_base) {
+            slot->pieces[i].iov_base = copied;
+            copied += slot->pieces[i].iov_len;
+        }
+    }
+
+    pthread_mutex_lock(&engine->outputLock);
+    if (engine->flush == FlushLine) {
+        size_t start = 0;
+        for (size_t i = 0; i < slot->lineCount; ++i) {
+            writerWrite(engine->writer, slot->pieces + start, slot->lineEnds[i] - start, 1);
+            start = slot->lineEnds[i];
+        }
+    } else {
+        writerWrite(engine->writer, slot->pieces, slot->pieceCount, engine->flush == FlushBatch);
+    }
+    pthread_mutex_unlock(&engine->outputLock);
+}
+
+static void resetSlot(struct slot *slot)
+{
+    for (size_t i = 0; i < slot->batch.count; ++i) {
+        struct query *query = &slot->batch.queries[i];
+        if (query->responseCleanup) {
+            query->responseCleanup(query);
+        }
+        if (query->queryCleanup) {
+            query->queryCleanup(query);
+        }
+    }
+    batchRelease(&slot->batch);
+
+    slot->batch.count = 0;
+    slot->dataLength = 0;
+    slot->pieceCount = 0;
+    slot->lineCount = 0;
+    slot->outputLength = 0;
+    slot->failed = 0;
+    slot->state = SlotFree;
+}
+
+static void *worker(void *data)
+{
+    struct engine *engine = (struct engine *)data;
+
+    pthread_mutex_lock(&engine->lock);
+    for (;;) {
+        while (!engine->stop && engine->claim == engine->tail) {
+            pthread_cond_wait(&engine->workReady, &engine->lock);
+        }
+        if (engine->claim == engine->tail) {
+            break;
+        }
+        struct slot *slot = &engine->slots[engine->claim++ % engine->slotCount];
+        slot->state = SlotBusy;
+        pthread_mutex_unlock(&engine->lock);
+
+        process(engine, slot);
+        if (!engine->ordered) {
+            writeSlot(engine, slot);
+        }
+
+        pthread_mutex_lock(&engine->lock);
+        slot->state = SlotDone;
+        pthread_cond_broadcast(&engine->slotDone);
+    }
+    pthread_mutex_unlock(&engine->lock);
+    return NULL;
+}
+
+// Waits for the oldest batch and writes it out; the reorder stage of
+// the ordered mode.
+static void retire(struct engine *engine)
+{
+    struct slot *slot = &engine->slots[engine->head % engine->slotCount];
+
+    pthread_mutex_lock(&engine->lock);
+    while (slot->state != SlotDone) {
+        pthread_cond_wait(&engine->slotDone, &engine->lock);
+    }
+    pthread_mutex_unlock(&engine->lock);
+
+    // Batches after a failed one are not written, so the ordered
+    // output ends where the first line is missing.
+    if (engine->ordered && !engine->failed) {
+        writeSlot(engine, slot);
+    }
+    engine->failed |= slot->failed;
+    resetSlot(slot);
+    ++engine->head;
+}
+
+static void publish(struct engine *engine)
+{
+    struct slot *slot = &engine->slots[engine->tail % engine->slotCount];
+    if (!slot->batch.count) {
+        return;
+    }
+
+    for (size_t i = 0; i < slot->batch.count; ++i) {
+        if (!slot->batch.queries[i].query) {
+            slot->batch.queries[i].query = slot->data + slot->offsets[i];
+        }
+    }
+
+    if (!engine->workerCount) {
+        process(engine, slot);
+        writeSlot(engine, slot);
+        engine->failed |= slot->failed;
+        resetSlot(slot);
+        return;
+    }
+
+    pthread_mutex_lock(&engine->lock);
+    slot->state = SlotReady;
+    ++engine->tail;
+    pthread_cond_signal(&engine->workReady);
+    pthread_mutex_unlock(&engine->lock);
+
+    if (engine->tail - engine->head == engine->slotCount) {
+        retire(engine);
+    }
+}
+
+static void releaseSlots(struct engine *engine)
+{
+    for (size_t i = 0; i < engine->slotCount; ++i) {
+        free(engine->slots[i].batch.queries);
+        arenaClean(&engine->slots[i].batch.arena);
+        free(engine->slots[i].offsets);
+        free(engine->slots[i].skip);
+        free(engine->slots[i].data);
+        free(engine->slots[i].output);
+        free(engine->slots[i].pieces);
+        free(engine->slots[i].lineEnds);
+    }
+    free(engine->slots);
+}
+
+struct engine *engineStart(const struct pipeline *pipeline,
+                           const struct engineSettings *settings)
+{
+    struct engine *engine = (struct engine *)calloc(1, sizeof(struct engine));
+    if (!engine) {
+        LOG(LFatal, "Allocation failed (%zu bytes)", sizeof(struct engine));
+        return NULL;
+    }
+
+    int threads = settings->threads;
+    if (threads < 1 || threads > maxThreads) {
+        LOG(LWarn, "Invalid number of threads %d, using default = %d", threads, defaultThreads);
+        threads = defaultThreads;
+    }
+
+    int batchSize = settings->batchSize;
+    if (batchSize < 1 || batchSize > maxBatchSize) {
+        LOG(LWarn, "Invalid batch size %d, using default = %d", batchSize, defaultBatchSize);
+        batchSize = defaultBatchSize;
+    }
+
+    engine->pipeline = pipeline;
+    engine->ordered = settings->ordered;
+    engine->batchSize = batchSize;
+    engine->slotCount = threads > 1 ? (size_t)threads * slotsPerThread : 1;
+    engine->slots = (struct slot *)calloc(engine->slotCount, sizeof(struct slot));
+    engine->workers = (pthread_t *)calloc(threads, sizeof(pthread_t));
+    if (!engine->slots || !engine->workers) {
+        LOG(LFatal, "Allocation failed (%zu bytes)", engine->slotCount * sizeof(struct slot));
+        free(engine->slots);
+        free(engine->workers);
+        free(engine);
+        return NULL;
+    }
+
+    for (size_t i = 0; i < engine->slotCount; ++i) {
+        struct slot *slot = &engine->slots[i];
+        slot->batch.queries = (struct query *)calloc(engine->batchSize, sizeof(struct query));
+        slot->offsets = (size_t *)calloc(engine->batchSize, sizeof(size_t));
+        slot->skip = (unsigned char *)calloc(engine->batchSize, sizeof(unsigned char));
+        slot->lineEnds = (size_t *)calloc(engine->batchSize, sizeof(size_t));
+        if (!slot->batch.queries || !slot->offsets || !slot->skip || !slot->lineEnds) {
+            LOG(LFatal, "Allocation failed (%zu bytes)", engine->batchSize * sizeof(struct query));
+            releaseSlots(engine);
+            free(engine->workers);
+            free(engine);
+            return NULL;
+        }
+    }
+
+    engine->writer = writerOpen(settings->output, settings->outputBuffer);
+    if (!engine->writer) {
+        releaseSlots(engine);
+        free(engine->workers);
+        free(engine);
+        return NULL;
+    }
+    engine->flush = settings->outputFlush;
+    if (engine->flush == FlushAuto) {
+        engine->flush = writerInteractive(engine->writer) ? FlushLine : FlushExit;
+    }
+
+    if (settings->stats.enabled) {
+        engine->stats = statsStart(pipeline, &settings->stats);
+        if (!engine->stats) {
+            LOG(LWarn, "Running without statistics");
+        }
+    }
+
+    pthread_mutex_init(&engine->lock, NULL);
+    pthread_cond_init(&engine->workReady, NULL);
+    pthread_cond_init(&engine->slotDone, NULL);
+    pthread_mutex_init(&engine->outputLock, NULL);
+
+    if (threads > 1) {
+        for (int i = 0; i < threads; ++i) {
+            if (pthread_create(&engine->workers[i], NULL, worker, engine)) {
+                LOG(LWarn, "Could not start worker thread, running with %d", engine->workerCount);
+                break;
+            }
+            ++engine->workerCount;
+        }
+    }
+
+    LOG(LDebug, "Engine started (threads: %d, ordered: %d, batch: %zu, flush: %d)",
+        engine->workerCount, engine->ordered, engine->batchSize, engine->flush);
+    return engine;
+}
+
+static void push(struct engine *engine, struct slot *slot, const char *line, size_t length)
+{
+    struct query *query = &slot->batch.queries[slot->batch.count];
+    memset(query, 0, sizeof(struct query));
+    query->query = line;
+    query->queryLength = length;
+    query->response = "";
+    query->arena = &slot->batch.arena;
+
+    if (++slot->batch.count == engine->batchSize) {
+        publish(engine);
+    }
+}
+
+int engineSubmit(struct engine *engine, const char *line, size_t length)
+{
+    if (engine->failed) {
+        return 1;
+    }
+    struct slot *slot = &engine->slots[engine->tail % engine->slotCount];
+
+    if (reserve(&slot->data, &slot->dataCapacity, slot->dataLength + length + 1)) {
+        return 1;
+    }
+    memcpy(slot->data + slot->dataLength, line, length);
+    slot->offsets[slot->batch.count] = slot->dataLength;
+    slot->dataLength += length;
+
+    push(engine, slot, NULL, length);
+    return 0;
+}
+
+int engineSubmitView(struct engine *engine, const char *line, size_t length)
+{
+    if (engine->failed) {
+        return 1;
+    }
+    push(engine, &engine->slots[engine->tail % engine->slotCount], line, length);
+    return 0;
+}
+
+int engineFinish(struct engine *engine)
+{
+    if (!engine) {
+        return 0;
+    }
+
+    publish(engine);
+    while (engine->head != engine->tail) {
+        retire(engine);
+    }
+
+    pthread_mutex_lock(&engine->lock);
+    engine->stop = 1;
+    pthread_cond_broadcast(&engine->workReady);
+    pthread_mutex_unlock(&engine->lock);
+
+    for (int i = 0; i < engine->workerCount; ++i) {
+        pthread_join(engine->workers[i], NULL);
+    }
+    writerClose(engine->writer);
+
+    if (engine->stats) {
+        statsDump(engine->stats);
+        statsClose(engine->stats);
+    }
+
+    pthread_mutex_destroy(&engine->outputLock);
+    pthread_cond_destroy(&engine->slotDone);
+    pthread_cond_destroy(&engine->workReady);
+    pthread_mutex_destroy(&engine->lock);
+
+    int failed = engine->failed;
+    releaseSlots(engine);
+    free(engine->workers);
+    free(engine);
+    return failed;
+}
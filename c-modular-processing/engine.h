@@ -0,0 +1,88 @@
+#ifndef ENGINE_H
+#define ENGINE_H
+
+#include <stddef.h>
+
+#include "module.h"
+#include "stats.h"
+#include "writer.h"
+
+enum {
+    defaultThreads = 1,
+    maxThreads = 256,
+    defaultBatchSize = 64,
+    maxBatchSize = 65536,
+    defaultOutputBuffer = 1 << 20
+};
+
+struct pipeline {
+    struct module *pre;
+    int preSize;
+    struct module *post;
+    int postSize;
+};
+
+struct engineSettings {
+    // Number of worker threads, 1 means the lines are processed
+    // on the calling thread.
+    int threads;
+    // Whether the output keeps the order of the input lines.
+    int ordered;
+    // Number of lines the modules process at once.
+    int batchSize;
+    // The output file or NULL for the standard output.
+    const char *output;
+    // Size of the output buffer, 0 to write every batch directly.
+    size_t outputBuffer;
+    // When the buffered output is written.
+    enum writerFlush outputFlush;
+    // Whether stages without an observable effect are dropped before
+    // the engine starts, see pipelineOptimize.
+    int optimize;
+    // Per-stage counters and latencies, dumped when the engine finishes.
+    struct statsSettings stats;
+};
+
+struct engine;
+
+/** Start the processing engine
+ *
+ *  @param pipeline The modules to run, they must outlive the engine.
+ *  @param settings The engine settings.
+ *  @return the engine or NULL in case the allocation fails or the output
+ *          cannot be opened
+ */
+struct engine *engineStart(const struct pipeline *pipeline,
+                           const struct engineSettings *settings);
+
+/** Queue one line for processing
+ *
+ *  @param engine The engine.
+ *  @param line The line, it is copied.
+ *  @param length The length of the line.
+ *  @return 0 in case of success
+ *          1 in case the allocation fails or the output of an earlier
+ *            line could not be stored
+ */
+int engineSubmit(struct engine *engine, const char *line, size_t length);
+
+/** Queue one line for processing without copying it
+ *
+ *  @param engine The engine.
+ *  @param line The line, it must stay valid until engineFinish.
+ *  @param length The length of the line.
+ *  @return 0 in case of success
+ *          1 in case the output of an earlier line could not be stored
+ */
+int engineSubmitView(struct engine *engine, const char *line, size_t length);
+
+/** Process all queued lines and release the engine
+ *
+ *  @param engine The engine.
+ *  @return 0 in case of success
+ *          1 in case the output of some line could not be stored,
+ *            the ordered output ends before it
+ */
+int engineFinish(struct engine *engine);
+
+#endif
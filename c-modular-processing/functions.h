@@ -1,15 +1,20 @@
 #ifndef FUNCTIONS_H
 #define FUNCTIONS_H
 
+#include <stdio.h>
+
 #include "config.h"
 #include "query.h"
 
 struct module;
 struct query;
+struct batch;
 
 typedef void(*queryCleanupFn)(struct query *);
 typedef void(*moduleCleanupFn)(struct module *);
 typedef int(*loadConfigFn)(struct module *, const struct config *, const char *);
 typedef void(*processFn)(struct module *, struct query *);
+typedef void(*processBatchFn)(struct module *, struct batch *);
+typedef void(*moduleDumpFn)(const struct module *, FILE *, int);
 
 #endif
@@ -0,0 +1,50 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "hash.h"
+
+static const uint64_t c1 = 0x87c37b91114253d5ull;
+static const uint64_t c2 = 0x4cf5ad432745937full;
+
+static uint64_t rotate(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static uint64_t mixWord(uint64_t h, uint64_t k)
+{
+    k *= c1;
+    k = rotate(k, 31);
+    k *= c2;
+    h ^= k;
+    return rotate(h, 27) * 5 + 0x52dce729;
+}
+
+// Final avalanche of MurmurHash3.
+static uint64_t finalize(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    return h;
+}
+
+size_t hashBytes(const void *data, size_t length)
+{
+    const unsigned char *p = (const unsigned char *)data;
+    uint64_t h = 0x9e3779b97f4a7c15ull ^ length;
+
+    for (; length >= sizeof(uint64_t); p += sizeof(uint64_t), length -= sizeof(uint64_t)) {
+        uint64_t k;
+        memcpy(&k, p, sizeof(k));
+        h = mixWord(h, k);
+    }
+    if (length) {
+        uint64_t k = 0;
+        memcpy(&k, p, length);
+        h = mixWord(h, k);
+    }
+    return (size_t)finalize(h);
+}
@@ -0,0 +1,17 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <stddef.h>
+
+/** Hash a sequence of bytes
+ *
+ *  All bits of the result are well distributed, so both the low and
+ *  the high bits may be used to pick a slot.
+ *
+ *  @param data The bytes.
+ *  @param length The number of bytes.
+ *  @return the hash
+ */
+size_t hashBytes(const void *data, size_t length);
+
+#endif
@@ -1,14 +1,93 @@
 #include "log.h"
 
+#include <pthread.h>
+#include <sched.h>
 #include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/time.h>
 #include <time.h>
 
+enum {
+    // Longer messages are truncated in the asynchronous mode, and so
+    // are the copies of the string arguments.
+    logRecordText = 256,
+    logRecordArgs = 16,
+    // Enough for any single conversion of a captured value.
+    logSpecLength = 32,
+    flusherSpinRounds = 64
+};
+
+// A captured argument, the string ones are copied into the record.
+union logArg {
+    long long integer;
+    unsigned long long unsignedInteger;
+    double real;
+    const void *pointer;
+    struct {
+        unsigned short offset;
+        unsigned short length;
+    } string;
+};
+
+// The caller captures the format and the arguments, the background
+// thread formats and writes them. A format the capture does not support
+// is formatted by the caller into text, fmt is NULL then.
+struct logRecord {
+    struct timeval time;
+    const char *file;
+    size_t line;
+    enum logCodes code;
+    const char *fmt;
+    union logArg args[logRecordArgs];
+    char text[logRecordText];
+};
+
+// One conversion of a format, as far as the capture understands it.
+struct logSpec {
+    const char *begin;
+    const char *end;
+    // Taken from the arguments in case of '*'.
+    int starWidth;
+    int starPrecision;
+    // 'i' for signed integers, 'u' unsigned, 'f' double, 'p' pointer,
+    // 's' string, '%' no argument, 0 not supported.
+    char kind;
+    // The length modifier, 'H' for hh and 'L' for ll.
+    char length;
+    char conversion;
+    int precision;
+};
+
+// Written by one thread, read by the background thread.
+struct logRing {
+    struct logRing *next;
+    size_t head;
+    size_t tail;
+    size_t mask;
+    struct logRecord records[];
+};
+
 static const char *logFile = NULL;
 static FILE *logStream = NULL;
-static int logLevel = LInfo;
+int logThreshold = LInfo;
+
+static struct {
+    int running;
+    int stop;
+    pthread_t thread;
+    size_t ringSize;
+    enum logFullPolicy policy;
+    // Only prepended while running, released at logStop.
+    struct logRing *rings;
+    pthread_mutex_t ringsLock;
+    size_t dropped;
+} async = { .ringsLock = PTHREAD_MUTEX_INITIALIZER };
+
+static __thread struct logRing *threadRing;
 
 void logClose()
 {
@@ -20,7 +99,7 @@ int setLogLevel(int level)
     if (level < LDebug || level > LNoLog)
         return -1;
 
-    logLevel = level;
+    logThreshold = level;
     return 0;
 }
 
@@ -42,33 +121,21 @@ int setLogFile(const char *file)
     return 0;
 }
 
-int logFunction(const char *file,
-                size_t line,
-                enum logCodes code,
-                const char *fmt, ...)
+static int writeLine(const struct timeval *time,
+                     enum logCodes code,
+                     const char *text,
+                     const char *file,
+                     size_t line)
 {
-    if ((int)code < logLevel || code == LNoLog) {
-        return 0;
-    }
     if (!logStream) {
         logStream = stderr;
     }
 
-    struct timeval now;
-    gettimeofday(&now, NULL);
+    struct tm local;
     char bufferTime[100];
-    size_t rc = strftime(bufferTime, sizeof(bufferTime), "%F %T", localtime(&now.tv_sec));
-    snprintf(bufferTime + rc, sizeof(bufferTime) - rc, ".%06ld", now.tv_usec);
- 
-    va_list args1;
-    va_start(args1, fmt);
-    va_list args2;
-    va_copy(args2, args1);
-    char bufferLog[1 + vsnprintf(NULL, 0, fmt, args1)];
-    va_end(args1);
-    vsnprintf(bufferLog, sizeof(bufferLog), fmt, args2);
-    va_end(args2);
- 
+    size_t rc = strftime(bufferTime, sizeof(bufferTime), "%F %T", localtime_r(&time->tv_sec, &local));
+    snprintf(bufferTime + rc, sizeof(bufferTime) - rc, ".%06ld", (long)time->tv_usec);
+
     const char *kind;
     switch (code) {
     case LDebug:   kind = "D"; break;
@@ -83,7 +150,452 @@ int logFunction(const char *file,
                    "%s [%s]: %s {%s:%lu}\n",
                    bufferTime,
                    kind,
-                   bufferLog,
+                   text,
                    file,
                    line);
-}
\ No newline at end of file
+}
+
+// Parses the conversion at the '%' the text points to.
+static void parseSpec(const char *text, struct logSpec *spec)
+{
+    const char *c = text + 1;
+    spec->begin = text;
+    spec->starWidth = 0;
+    spec->starPrecision = 0;
+    spec->precision = -1;
+    spec->length = 0;
+    spec->kind = 0;
+
+    while (*c && strchr("-+ #0", *c)) {
+        ++c;
+    }
+    if (*c == '*') {
+        spec->starWidth = 1;
+        ++c;
+    } else {
+        while (*c >= '0' && *c <= '9') {
+            ++c;
+        }
+    }
+    if (*c == '.') {
+        ++c;
+        if (*c == '*') {
+            spec->starPrecision = 1;
+            ++c;
+        } else {
+            spec->precision = 0;
+            while (*c >= '0' && *c <= '9') {
+                spec->precision = 10 * spec->precision + (*c++ - '0');
+            }
+        }
+    }
+    if ((c[0] == 'h' && c[1] == 'h') || (c[0] == 'l' && c[1] == 'l')) {
+        spec->length = c[0] == 'h' ? 'H' : 'L';
+        c += 2;
+    } else if (*c && strchr("hlzjt", *c)) {
+        spec->length = *c++;
+    }
+
+    spec->conversion = *c;
+    spec->end = *c ? c + 1 : c;
+    switch (*c) {
+    case 'd': case 'i': case 'c':
+        spec->kind = spec->conversion == 'c' && spec->length ? 0 : 'i';
+        break;
+    case 'u': case 'o': case 'x': case 'X':
+        spec->kind = 'u';
+        break;
+    case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+        spec->kind = spec->length ? 0 : 'f';
+        break;
+    case 'p':
+        spec->kind = spec->length ? 0 : 'p';
+        break;
+    case 's':
+        spec->kind = spec->length ? 0 : 's';
+        break;
+    case '%':
+        spec->kind = spec->end == text + 2 ? '%' : 0;
+        break;
+    default:
+        break;
+    }
+}
+
+static long long signedArg(char length, va_list *args)
+{
+    switch (length) {
+    case 'l': return va_arg(*args, long);
+    case 'L': return va_arg(*args, long long);
+    case 'z': return va_arg(*args, ptrdiff_t);
+    case 'j': return va_arg(*args, intmax_t);
+    case 't': return va_arg(*args, ptrdiff_t);
+    default:  return va_arg(*args, int);
+    }
+}
+
+static unsigned long long unsignedArg(char length, va_list *args)
+{
+    switch (length) {
+    case 'l': return va_arg(*args, unsigned long);
+    case 'L': return va_arg(*args, unsigned long long);
+    case 'z': return va_arg(*args, size_t);
+    case 'j': return va_arg(*args, uintmax_t);
+    case 't': return va_arg(*args, size_t);
+    default:  return va_arg(*args, unsigned);
+    }
+}
+
+/** Copy the arguments of the format into the record
+ *
+ *  Numbers and pointers are stored as they are, strings are copied,
+ *  so the caller may release them right after.
+ *
+ *  @return 0 in case of success
+ *          1 in case the format needs more arguments than the record
+ *            holds or has a conversion the capture does not support
+ */
+static int capture(struct logRecord *record, const char *fmt, va_list *args)
+{
+    size_t count = 0;
+    size_t used = 0;
+    for (const char *c = fmt; (c = strchr(c, '%')); ) {
+        struct logSpec spec;
+        parseSpec(c, &spec);
+        c = spec.end;
+        if (spec.kind == '%') {
+            continue;
+        }
+        if (!spec.kind || count + spec.starWidth + spec.starPrecision + 1 > logRecordArgs) {
+            return 1;
+        }
+
+        if (spec.starWidth) {
+            record->args[count++].integer = va_arg(*args, int);
+        }
+        if (spec.starPrecision) {
+            spec.precision = va_arg(*args, int);
+            record->args[count++].integer = spec.precision;
+        }
+
+        union logArg *arg = &record->args[count++];
+        switch (spec.kind) {
+        case 'i':
+            arg->integer = signedArg(spec.length, args);
+            break;
+        case 'u':
+            arg->unsignedInteger = unsignedArg(spec.length, args);
+            break;
+        case 'f':
+            arg->real = va_arg(*args, double);
+            break;
+        case 'p':
+            arg->pointer = va_arg(*args, const void *);
+            break;
+        case 's': {
+            const char *text = va_arg(*args, const char *);
+            if (!text) {
+                text = "(null)";
+            }
+            size_t length = spec.precision >= 0 ? strnlen(text, (size_t)spec.precision) : strlen(text);
+            if (length > sizeof(record->text) - used) {
+                length = sizeof(record->text) - used;
+            }
+            memcpy(record->text + used, text, length);
+            arg->string.offset = (unsigned short)used;
+            arg->string.length = (unsigned short)length;
+            used += length;
+            break;
+        }
+        }
+    }
+    return 0;
+}
+
+// Formats a captured record into the text, truncated to its size.
+static void format(const struct logRecord *record, char *text, size_t size)
+{
+    size_t used = 0;
+    size_t count = 0;
+    const char *c = record->fmt;
+    while (*c && used + 1 < size) {
+        const char *percent = strchr(c, '%');
+        size_t literal = percent ? (size_t)(percent - c) : strlen(c);
+        if (literal > size - 1 - used) {
+            literal = size - 1 - used;
+        }
+        memcpy(text + used, c, literal);
+        used += literal;
+        if (!percent || used + 1 >= size) {
+            break;
+        }
+
+        struct logSpec spec;
+        parseSpec(percent, &spec);
+        c = spec.end;
+        if (spec.kind == '%') {
+            text[used++] = '%';
+            continue;
+        }
+
+        // The flags and the digits of the conversion are kept, the
+        // length modifier is replaced by the one of the stored value.
+        char conversion[logSpecLength];
+        size_t digits = spec.end - spec.begin - 1 - (spec.length ? 1 : 0) - (spec.length == 'H' || spec.length == 'L' ? 1 : 0);
+        if (digits + 4 > sizeof(conversion)) {
+            break;
+        }
+        memcpy(conversion, spec.begin, digits);
+        conversion[digits] = '\0';
+        if (spec.kind == 'i' && spec.conversion != 'c') {
+            strcat(conversion, "ll");
+        } else if (spec.kind == 'u') {
+            strcat(conversion, "ll");
+        }
+        size_t conversionLength = strlen(conversion);
+        conversion[conversionLength] = spec.conversion;
+        conversion[conversionLength + 1] = '\0';
+
+        int width = spec.starWidth ? (int)record->args[count++].integer : 0;
+        int precision = spec.starPrecision ? (int)record->args[count++].integer : 0;
+        const union logArg *arg = &record->args[count++];
+        char *out = text + used;
+        size_t left = size - used;
+        int written = 0;
+
+#define LOG_FORMAT_ARG(VALUE) \
+        (spec.starWidth && spec.starPrecision ? snprintf(out, left, conversion, width, precision, VALUE) : \
+         spec.starWidth ? snprintf(out, left, conversion, width, VALUE) : \
+         spec.starPrecision ? snprintf(out, left, conversion, precision, VALUE) : \
+         snprintf(out, left, conversion, VALUE))
+
+        switch (spec.kind) {
+        case 'i':
+            written = spec.conversion == 'c' ? LOG_FORMAT_ARG((int)arg->integer) : LOG_FORMAT_ARG(arg->integer);
+            break;
+        case 'u':
+            written = LOG_FORMAT_ARG(arg->unsignedInteger);
+            break;
+        case 'f':
+            written = LOG_FORMAT_ARG(arg->real);
+            break;
+        case 'p':
+            written = LOG_FORMAT_ARG(arg->pointer);
+            break;
+        case 's': {
+            // The copy already respects the precision.
+            precision = arg->string.length;
+            const char *copy = record->text + arg->string.offset;
+            if (!spec.starPrecision) {
+                // Turns a missing or fixed precision into '*'.
+                char *dot = strchr(conversion + 1, '.');
+                if (dot) {
+                    *dot = '\0';
+                } else {
+                    conversion[conversionLength] = '\0';
+                }
+                strcat(conversion, ".*s");
+                spec.starPrecision = 1;
+            }
+            written = LOG_FORMAT_ARG(copy);
+            break;
+        }
+        default:
+            break;
+        }
+#undef LOG_FORMAT_ARG
+
+        if (written < 0) {
+            break;
+        }
+        used += (size_t)written < left ? (size_t)written : left - 1;
+    }
+    text[used] = '\0';
+}
+
+static size_t drain(void)
+{
+    size_t written = 0;
+    for (struct logRing *ring = __atomic_load_n(&async.rings, __ATOMIC_ACQUIRE); ring; ring = ring->next) {
+        size_t tail = ring->tail;
+        size_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        for (; tail != head; ++tail) {
+            const struct logRecord *record = &ring->records[tail & ring->mask];
+            if (record->fmt) {
+                char text[logRecordText];
+                format(record, text, sizeof(text));
+                writeLine(&record->time, record->code, text, record->file, record->line);
+            } else {
+                writeLine(&record->time, record->code, record->text, record->file, record->line);
+            }
+            ++written;
+        }
+        __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+    }
+
+    size_t dropped = __atomic_exchange_n(&async.dropped, 0, __ATOMIC_RELAXED);
+    if (dropped) {
+        struct timeval now;
+        gettimeofday(&now, NULL);
+        char text[64];
+        snprintf(text, sizeof(text), "%zu log records dropped", dropped);
+        writeLine(&now, LWarn, text, __FILE__, __LINE__);
+        ++written;
+    }
+    if (written) {
+        fflush(logStream);
+    }
+    return written;
+}
+
+static void *flusher(void *data)
+{
+    (void)data;
+    const struct timespec idle = { 0, 1000000 };
+    unsigned idleRounds = 0;
+    for (;;) {
+        int stop = __atomic_load_n(&async.stop, __ATOMIC_ACQUIRE);
+        if (drain()) {
+            idleRounds = 0;
+            continue;
+        }
+        // Records written before the stop are drained above.
+        if (stop) {
+            break;
+        }
+        // Stays responsive while the log is busy, sleeps once it is quiet.
+        if (++idleRounds < flusherSpinRounds) {
+            sched_yield();
+        } else {
+            nanosleep(&idle, NULL);
+        }
+    }
+    return NULL;
+}
+
+static struct logRing *registerRing(void)
+{
+    struct logRing *ring = (struct logRing *)calloc(1, sizeof(struct logRing) + async.ringSize * sizeof(struct logRecord));
+    if (!ring) {
+        return NULL;
+    }
+    ring->mask = async.ringSize - 1;
+
+    pthread_mutex_lock(&async.ringsLock);
+    ring->next = async.rings;
+    __atomic_store_n(&async.rings, ring, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&async.ringsLock);
+
+    threadRing = ring;
+    return ring;
+}
+
+// Returns nonzero in case the record has to be written synchronously.
+static int enqueue(const char *file, size_t line, enum logCodes code, const char *fmt, va_list args)
+{
+    struct logRing *ring = threadRing ? threadRing : registerRing();
+    if (!ring) {
+        return 1;
+    }
+
+    size_t head = ring->head;
+    while (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) > ring->mask) {
+        if (async.policy == LogDrop) {
+            __atomic_add_fetch(&async.dropped, 1, __ATOMIC_RELAXED);
+            return 0;
+        }
+        sched_yield();
+    }
+
+    // The time is taken here, when the event happens.
+    struct logRecord *record = &ring->records[head & ring->mask];
+    gettimeofday(&record->time, NULL);
+    record->file = file;
+    record->line = line;
+    record->code = code;
+    record->fmt = fmt;
+
+    va_list captured;
+    va_copy(captured, args);
+    if (capture(record, fmt, &captured)) {
+        record->fmt = NULL;
+        vsnprintf(record->text, sizeof(record->text), fmt, args);
+    }
+    va_end(captured);
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+static void logStop(void)
+{
+    if (!async.running) {
+        return;
+    }
+    __atomic_store_n(&async.stop, 1, __ATOMIC_RELEASE);
+    pthread_join(async.thread, NULL);
+    async.running = 0;
+
+    while (async.rings) {
+        struct logRing *ring = async.rings;
+        async.rings = ring->next;
+        free(ring);
+    }
+    threadRing = NULL;
+}
+
+int setLogAsync(size_t records, enum logFullPolicy policy)
+{
+    if (async.running || records < 2) {
+        return -1;
+    }
+
+    size_t size = 2;
+    while (size < records) {
+        size *= 2;
+    }
+    async.ringSize = size;
+    async.policy = policy;
+    async.stop = 0;
+    if (pthread_create(&async.thread, NULL, flusher, NULL)) {
+        return -1;
+    }
+    async.running = 1;
+    atexit(logStop);
+    return 0;
+}
+
+int logFunction(const char *file,
+                size_t line,
+                enum logCodes code,
+                const char *fmt, ...)
+{
+    if ((int)code < logThreshold || code == LNoLog) {
+        return 0;
+    }
+
+    // Fatal messages are written right away, the process may not
+    // get far enough to flush them.
+    if (async.running && code != LFatal) {
+        va_list args;
+        va_start(args, fmt);
+        int rv = enqueue(file, line, code, fmt, args);
+        va_end(args);
+        if (!rv) {
+            return 0;
+        }
+    }
+
+    struct timeval now;
+    gettimeofday(&now, NULL);
+
+    va_list args1;
+    va_start(args1, fmt);
+    va_list args2;
+    va_copy(args2, args1);
+    char bufferLog[1 + vsnprintf(NULL, 0, fmt, args1)];
+    va_end(args1);
+    vsnprintf(bufferLog, sizeof(bufferLog), fmt, args2);
+    va_end(args2);
+
+    return writeLine(&now, code, bufferLog, file, line);
+}
@@ -12,14 +12,48 @@ enum logCodes {
     LNoLog
 };
 
+// What the asynchronous logger does when the ring of a thread is full.
+enum logFullPolicy {
+    LogBlock,
+    LogDrop
+};
+
+// Calls below this level are compiled out, the build may raise it
+// by defining LOG_MIN_LEVEL, e.g. -DLOG_MIN_LEVEL=LInfo.
+#ifndef LOG_MIN_LEVEL
+#define LOG_MIN_LEVEL LDebug
+#endif
+
+// Set by setLogLevel, read by LOG before the arguments are evaluated.
+extern int logThreshold;
+
 int setLogLevel(int level);
 int setLogFile(const char *file);
 
+/** Write the log on a background thread
+ *
+ *  Every thread copies the format and its arguments, strings included,
+ *  into its own ring, the background thread formats and writes them. Messages are truncated to 255
+ *  characters, fatal ones are still written synchronously. The log
+ *  file must be set before, the rest of the log is written at exit.
+ *
+ *  @param records The number of records a ring holds, rounded up
+ *                 to a power of two.
+ *  @param policy Whether a thread waits or the record is dropped
+ *                when its ring is full.
+ *  @return 0 in case of success
+ *          -1 in case the logger already runs or cannot be started
+ */
+int setLogAsync(size_t records, enum logFullPolicy policy);
+
 int logFunction(const char *file,
                 size_t line,
                 enum logCodes code,
                 const char *fmt, ...);
 
-#define LOG(CODE, ...) logFunction(__FILE__, __LINE__, CODE, ##__VA_ARGS__)
+#define LOG_ENABLED(CODE) ((CODE) >= LOG_MIN_LEVEL && (int)(CODE) >= logThreshold)
+
+#define LOG(CODE, ...) \
+    (LOG_ENABLED(CODE) ? (void)logFunction(__FILE__, __LINE__, CODE, ##__VA_ARGS__) : (void)0)
 
 #endif
@@ -2,103 +2,48 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
-#include <ctype.h>
 
 #include "log.h"
 #include "config.h"
+#include "engine.h"
+#include "pipeline.h"
+#include "reader.h"
 #include "module-cache.h"
 #include "module-toupper.h"
 #include "module-tolower.h"
 #include "module-decorate.h"
 #include "module-magic.h"
 
-
-void process(const char *queryText, struct module *pre, int preSize, struct module *post, int postSize)
-{
-    struct query query;
-    memset(&query, 0, sizeof(struct query));
-    query.query = queryText;
-    query.queryCleanup = NULL;
-    query.response = "";
-    query.responseCleanup = NULL;
-
-    LOG(LInfo, "query: %s", queryText);
-
-    for (int m = 0; m < preSize; ++m) {
-        LOG(LDebug, "Running module %s", pre[m].name);
-        pre[m].process(&pre[m], &query);
-
-        switch (query.responseCode) {
-        case RCSuccess:
-            LOG(LInfo, "Response success");
-        case RCDone:
-            LOG(LInfo, "Response done");
-        case RCError:
-            LOG(LError, "Error");
-        default:
-            LOG(LError, "Error");
-        }
-    }
-
-    LOG(LDebug, "responseCode: %i", query.responseCode);
-    if (query.responseCode == RCSuccess) {
-        for (int m = 0; m < postSize; ++m) {
-            LOG(LDebug, "Postprocessing by %s", post[m].name);
-            if (pre[m].postProcess) {
-                post[m].postProcess(&post[m], &query);
-                switch (query.responseCode) {
-                case RCSuccess:
-                    LOG(LInfo, "Response success");
-                    continue;
-                case RCDone:
-                    LOG(LInfo, "Response done");
-                    break;
-                case RCError:
-                    LOG(LError, "Error");
-                    break;
-                default:
-                    LOG(LError, "Error");
-                    break;
-                }
-            }
-        }
-    }
-
-    LOG(LInfo, "response: %s", query.response);
-    char *status = NULL;
-
-    if (query.responseCode == RCSuccess) {
-        status = "SUCCES";
-    } else if (query.responseCode == RCDone) {
-        status = "DONE";
-    } else if (query.responseCode == RCError) {
-        status = "ERROR";
-    } else {
-        status = "UNKNOWN";
-    }
-
-    printf("query: %s\nresponse: %s\nstatus: %s\n", query.query, status, query.response);
-
-    if (query.responseCleanup) {
-        query.responseCleanup(&query);
-    }
-    if (query.queryCleanup) {
-        query.queryCleanup(&query);
-    }
-}
+enum {
+    defaultLogQueueSize = 4096,
+    // Exit code of hw04 as well.
+    loadConfigNoMemory = 4
+};
 
 
 void setLogSetting(const struct config *cfg)
 {
-    const char *logFile;
-    if (!configValue(cfg, "log", "File", CfgString, &logFile)) {
+    const char *logFile = NULL;
+    const char *logLevel = NULL;
+    int async = 0;
+    int queueSize = defaultLogQueueSize;
+    const char *whenFull = NULL;
+    struct configField fields[] = {
+        { "File", CfgString, &logFile, 0 },
+        { "Level", CfgString, &logLevel, 0 },
+        { "Async", CfgBool, &async, 0 },
+        { "QueueSize", CfgInteger, &queueSize, 0 },
+        { "WhenFull", CfgString, &whenFull, 0 }
+    };
+    configFields(cfg, "log", fields, sizeof(fields) / sizeof(*fields));
+
+    if (logFile) {
         if (setLogFile(logFile)) {
             LOG(LWarn, "Invalid value for File: '%s'", logFile);
         }
     }
 
-    const char *logLevel;
-    if (!configValue(cfg, "log", "Level", CfgString, &logLevel)) {
+    if (logLevel) {
         if (!strcmp(logLevel, "D") || !strcmp(logLevel, "d")) {
             setLogLevel(LDebug);
         } else if (!strcmp(logLevel, "I") || !strcmp(logLevel, "i")) {
@@ -115,6 +60,30 @@ void setLogSetting(const struct config *cfg)
             LOG(LWarn, "Invalid value for Mask: '%s'", logLevel);
         }
     }
+
+    if (fields[2].status == 3) {
+        LOG(LWarn, "Could not read value Async, using default = false");
+    }
+    if (!async) {
+        return;
+    }
+
+    if (queueSize < 2) {
+        queueSize = defaultLogQueueSize;
+    }
+
+    enum logFullPolicy policy = LogBlock;
+    if (whenFull) {
+        if (!strcmp(whenFull, "drop")) {
+            policy = LogDrop;
+        } else if (strcmp(whenFull, "block")) {
+            LOG(LWarn, "Invalid value for WhenFull: '%s'", whenFull);
+        }
+    }
+
+    if (setLogAsync(queueSize, policy)) {
+        LOG(LWarn, "Could not start the asynchronous log");
+    }
 }
 
 
@@ -237,10 +206,13 @@ void initModule(char *data, struct module *modules, struct module *orig, int siz
 }
 
 
+// Returns 1 in case Process cannot be read, the defaults are used then,
+// and loadConfigNoMemory in case a setting cannot be copied.
 int loadConfig(const char *configFile,
                struct module *modules,
                char **sequenceModulesPre,
                char **sequenceModulesPost,
+               struct engineSettings *settings,
                int modulesCount)
 {
     struct config cfg;
@@ -288,6 +260,92 @@ int loadConfig(const char *configFile,
         *sequenceModulesPost = postProcess;
     }
 
+    // The settings keep their defaults unless the value is valid.
+    const char *output = NULL;
+    const char *flush = NULL;
+    struct configField run[] = {
+        { "Threads", CfgCount, &settings->threads, 0 },
+        { "Ordered", CfgBool, &settings->ordered, 0 },
+        { "BatchSize", CfgCount, &settings->batchSize, 0 },
+        { "Output", CfgString, &output, 0 },
+        { "OutputBuffer", CfgSize, &settings->outputBuffer, 0 },
+        { "Optimize", CfgBool, &settings->optimize, 0 },
+        { "OutputFlush", CfgString, &flush, 0 }
+    };
+    configFields(&cfg, "run", run, sizeof(run) / sizeof(*run));
+
+    if (run[0].status == 3) {
+        LOG(LWarn, "Could not read value Threads, using default = %d", settings->threads);
+    }
+    if (run[1].status == 3) {
+        LOG(LWarn, "Could not read value Ordered, using default = %s", settings->ordered ? "true" : "false");
+    }
+    if (run[2].status == 3) {
+        LOG(LWarn, "Could not read value BatchSize, using default = %d", settings->batchSize);
+    }
+    if (run[4].status == 3) {
+        LOG(LWarn, "Could not read value OutputBuffer, using default = %zu", settings->outputBuffer);
+    }
+    if (run[5].status == 3) {
+        LOG(LWarn, "Could not read value Optimize, using default = %s", settings->optimize ? "true" : "false");
+    }
+
+    if (output && strcmp(output, "-")) {
+        char *copy = (char*)calloc(strlen(output) + 1, sizeof(char));
+        if (!copy) {
+            LOG(LFatal, "Allocation failed (%zu bytes)", strlen(output) + 1);
+            configClean(&cfg);
+            return loadConfigNoMemory;
+        }
+        strcpy(copy, output);
+        settings->output = copy;
+    }
+
+    if (flush) {
+        if (!strcmp(flush, "line")) {
+            settings->outputFlush = FlushLine;
+        } else if (!strcmp(flush, "batch")) {
+            settings->outputFlush = FlushBatch;
+        } else if (!strcmp(flush, "exit")) {
+            settings->outputFlush = FlushExit;
+        } else {
+            LOG(LWarn, "Invalid value for OutputFlush: '%s'", flush);
+        }
+    }
+
+    const char *statsFile = NULL;
+    const char *statsFormat = NULL;
+    struct configField stats[] = {
+        { "Enabled", CfgBool, &settings->stats.enabled, 0 },
+        { "File", CfgString, &statsFile, 0 },
+        { "Format", CfgString, &statsFormat, 0 }
+    };
+    configFields(&cfg, "stats", stats, sizeof(stats) / sizeof(*stats));
+
+    if (stats[0].status == 3) {
+        LOG(LWarn, "Could not read value Enabled, the statistics are not collected");
+        settings->stats.enabled = 0;
+    }
+
+    if (statsFile && strcmp(statsFile, "-")) {
+        char *copy = (char*)calloc(strlen(statsFile) + 1, sizeof(char));
+        if (!copy) {
+            LOG(LFatal, "Allocation failed (%zu bytes)", strlen(statsFile) + 1);
+            configClean(&cfg);
+            return loadConfigNoMemory;
+        }
+        strcpy(copy, statsFile);
+        settings->stats.file = copy;
+    }
+
+    if (statsFormat) {
+        if (!strcmp(statsFormat, "json")) {
+            settings->stats.format = StatsJson;
+        } else if (strcmp(statsFormat, "text")) {
+            LOG(LWarn, "Invalid value for Format: '%s'", statsFormat);
+        }
+    }
+
     char section[265] = "module::";
     char *moduleName = section + strlen(section);
     for (int m = 0; m < modulesCount; ++m) {
@@ -306,30 +364,45 @@ int loadConfig(const char *configFile,
 }
 
 
-void processFile(const char *file,
-                 struct module *pre,
-                 int preSize,
-                 struct module *post,
-                 int postSize)
+// Returns nonzero in case the engine cannot start or loses output.
+int processFile(const char *file,
+                const struct pipeline *pipeline,
+                const struct engineSettings *settings)
 {
     LOG(LDebug, "Opening file '%s'", file);
-    FILE *input = fopen(file, "r");
+    struct reader *input = readerOpen(file);
     if (!input) {
         LOG(LError, "Cannot open file '%s'", file);
-        return;
+        return 0;
     }
-    char line[64 + 1] = {0};
 
-    for (int i = 1; fgets(line, 64, input); ++i) {
-        
-        for (char *end = line + strlen(line) - 1; isspace(*end); --end) {
-            *end = '\0';
+    struct engine *engine = engineStart(pipeline, settings);
+    if (!engine) {
+        readerClose(input);
+        return 1;
+    }
+
+    int (*submit)(struct engine *, const char *, size_t) = readerStable(input) ?
+        engineSubmitView :
+        engineSubmit;
+
+    const char *line;
+    size_t length;
+    int failed = 0;
+    while (readerNext(input, &line, &length) > 0) {
+        LOG(LDebug, "line: '%.*s'", (int)length, line);
+        if (submit(engine, line, length)) {
+            failed = 1;
+            break;
         }
+    }
 
-        LOG(LDebug, "line: '%s'", line);
-        process(line, pre, preSize, post, postSize);
+    failed |= engineFinish(engine);
+    readerClose(input);
+    if (failed) {
+        LOG(LError, "Some lines were not processed");
     }
-    fclose(input);
+    return failed;
 }
 
 
@@ -345,7 +418,9 @@ int main(int argc, char **argv)
 
     int modulesCount = 5;
 
+    // Hooks a module does not set stay NULL.
     struct module modules[5];
+    memset(modules, 0, sizeof(modules));
     moduleCache(&modules[0]);
     moduleToUpper(&modules[1]);
     moduleDecorate(&modules[2]);
@@ -355,55 +430,75 @@ int main(int argc, char **argv)
     char *seqModulesPre = NULL;
     char *seqModulesPost = NULL;
 
+    struct engineSettings settings = {
+        defaultThreads, 1, defaultBatchSize,
+        NULL, defaultOutputBuffer, FlushAuto, 1,
+        { 0, NULL, StatsText }
+    };
+
     int rv;
-    if ((rv = loadConfig(configFile, modules, &seqModulesPre, &seqModulesPost, modulesCount))) {
-        if (rv == 1)
-            LOG(LWarn, "config file %s is missing", configFile);
-        else
-            return rv;
+    if ((rv = loadConfig(configFile, modules, &seqModulesPre, &seqModulesPost, &settings, modulesCount))) {
+        if (rv != 1) {
+            goto cleanup;
+        }
+        LOG(LWarn, "config file %s is missing", configFile);
+        rv = 0;
     }
 
     int sizeProcess = 0;
     if (!processOrderModules(seqModulesPre, &sizeProcess)) {
         LOG(LError, "Function 'processOrderModules' end with 0 code");
-        free(seqModulesPre);
-        free(seqModulesPost);
-        return 1;
+        rv = 1;
+        goto cleanup;
     }
 
     int sizePostProcess = 0;
     if (!processOrderModules(seqModulesPost, &sizePostProcess)) {
         LOG(LError, "Function 'processOrderModules' end with 0 code");
-        free(seqModulesPre);
-        free(seqModulesPost);
-        return 1;
+        rv = 1;
+        goto cleanup;
     }
 
     if (!checkPostProcessFunctions(seqModulesPost, modules, modulesCount)) {
         LOG(LError, "Function 'checkPostProcessFunctions' end with 0 code");
-        free(seqModulesPre);
-        free(seqModulesPost);
-        return 1;
+        rv = 1;
+        goto cleanup;
     }
 
     LOG(LInfo, "Start");
 
-    struct module selectedModulesPre[sizeProcess];
-    initModule(seqModulesPre, selectedModulesPre, modules, sizeProcess);
-    struct module selectedModulesPost[sizePostProcess];
-    initModule(seqModulesPost, selectedModulesPost, modules, sizePostProcess);
-
-    processFile(inputFile, selectedModulesPre, sizeProcess, selectedModulesPost, sizePostProcess);
+    // A block of its own, the jumps to cleanup must not enter the scope
+    // of the arrays.
+    {
+        struct module selectedModulesPre[sizeProcess];
+        initModule(seqModulesPre, selectedModulesPre, modules, sizeProcess);
+        struct module selectedModulesPost[sizePostProcess];
+        initModule(seqModulesPost, selectedModulesPost, modules, sizePostProcess);
+
+        struct pipeline pipeline = {
+            selectedModulesPre, sizeProcess,
+            selectedModulesPost, sizePostProcess
+        };
+        if (settings.optimize) {
+            int dropped = pipelineOptimize(&pipeline);
+            LOG(LInfo, "Dropped %d stages from the pipeline", dropped);
+        }
+        rv = processFile(inputFile, &pipeline, &settings);
+    }
 
+    // Only after a run, the cache saves its snapshot here.
     for (int m = 0; m < modulesCount; ++m) {
         if (modules[m].cleanup) {
             modules[m].cleanup(&modules[m]);
         }
     }
 
+    LOG(LInfo, "Finished");
+
+cleanup:
     free(seqModulesPre);
     free(seqModulesPost);
-
-    LOG(LInfo, "Finished");
-    return 0;
+    free((char*)settings.output);
+    free((char*)settings.stats.file);
+    return rv;
 }
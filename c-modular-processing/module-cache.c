@@ -1,41 +1,344 @@
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
-#include <time.h>
 #include <string.h>
 
+#include "cache-slab.h"
+#include "cache-snapshot.h"
+#include "cache-table.h"
+#include "cache-wheel.h"
+#include "clock.h"
 #include "log.h"
 #include "module-cache.h"
 #include "config.h"
 
 enum {
     defaultTimeout = 2,
-    defaultBucketCount = 32
+    defaultBucketCount = 32,
+    defaultShards = 16,
+    maxShards = 1024,
+    // Shards are selected by the top bits of the hash, the table uses
+    // the low ones.
+    shardBits = 16
 };
 
-struct cacheItem {
-    char *key;
-    char *response;
-    size_t responseLength;
-    enum responseCode responseCode;
-    time_t timeOfDeath;
-    struct cacheItem *next;
-};
+// Items are spread over independently locked shards, every shard has
+// its own table, eviction clock and limits.
+struct cacheShard {
+    struct cacheTable table;
+
+    // Limits of the shard, SIZE_MAX means unlimited. When exceeded,
+    // items are evicted by the clock (second chance) algorithm.
+    size_t maxEntries;
+    size_t maxBytes;
+    size_t bytes;
+    struct cacheItem *clockHand;
+
+    // Expires items as the time goes, lookups only skip expired ones.
+    struct timerWheel wheel;
+
+    // Every item is a single block, the key and the response follow
+    // the header.
+    struct slabAllocator slab;
 
-struct bucket {
-    struct cacheItem *first;
-    struct cacheItem *last;
+    // Lookups share the lock, hits only set the referenced flag.
+    pthread_rwlock_t lock;
+    // Lock acquisitions, and those which had to wait.
+    size_t acquired;
+    size_t contended;
+
+    // Lookups which found a live item and those which did not, counted
+    // under the shared lock.
+    size_t hits;
+    size_t misses;
+    // Counted under the exclusive lock.
+    size_t inserts;
+    size_t expirations;
+    size_t evictions;
 };
 
 struct cache {
-    struct bucket *buckets;
+    struct cacheShard *shards;
+    // Always a power of two.
+    size_t shardCount;
+
+    // Only the initial capacity of the tables, they grow as needed.
     size_t bucketCount;
-    int timeout;
+    // Milliseconds.
+    uint64_t timeout;
+
+    // Limits of the whole cache, split evenly among the shards.
+    size_t maxEntries;
+    size_t maxBytes;
+
+    // Back the items by huge pages.
+    int hugePages;
+
+    // Live items are saved here by cleanup and loaded back by loadConfig,
+    // or NULL.
+    char *snapshotFile;
 };
 
 MODULE_PRIVATE
-void responseCleanup(struct query *query)
+size_t itemSize(size_t keyLength, size_t responseLength)
+{
+    return sizeof(struct cacheItem) + keyLength + responseLength + 2;
+}
+
+// Expects the shard to be locked for writing. Only the block is set up.
+MODULE_PRIVATE
+struct cacheItem *allocItem(struct cacheShard *shard,
+                            const char *key,
+                            size_t keyLength,
+                            const char *response,
+                            size_t responseLength)
+{
+    struct cacheItem *item = (struct cacheItem *)slabAlloc(&shard->slab, itemSize(keyLength, responseLength));
+    if (!item) {
+        return NULL;
+    }
+    item->key = (char *)(item + 1);
+    memcpy(item->key, key, keyLength);
+    item->key[keyLength] = '\0';
+    item->keyLength = keyLength;
+    item->response = item->key + keyLength + 1;
+    memcpy(item->response, response, responseLength);
+    item->response[responseLength] = '\0';
+    item->responseLength = responseLength;
+    return item;
+}
+
+MODULE_PRIVATE
+void freeItem(struct cacheShard *shard, struct cacheItem *item)
+{
+    slabFree(&shard->slab, item, itemSize(item->keyLength, item->responseLength));
+}
+
+MODULE_PRIVATE
+size_t itemBytes(const struct cacheItem *item)
+{
+    return slabBlockSize(itemSize(item->keyLength, item->responseLength));
+}
+
+MODULE_PRIVATE
+size_t shardIndex(const struct cache *cache, size_t hash)
+{
+    return (hash >> (sizeof(size_t) * CHAR_BIT - shardBits)) & (cache->shardCount - 1);
+}
+
+MODULE_PRIVATE
+void readLock(struct cacheShard *shard)
 {
-    free(query->response);
-    query->response = NULL;
+    if (pthread_rwlock_tryrdlock(&shard->lock)) {
+        __atomic_add_fetch(&shard->contended, 1, __ATOMIC_RELAXED);
+        pthread_rwlock_rdlock(&shard->lock);
+    }
+    __atomic_add_fetch(&shard->acquired, 1, __ATOMIC_RELAXED);
+}
+
+MODULE_PRIVATE
+void writeLock(struct cacheShard *shard)
+{
+    if (pthread_rwlock_trywrlock(&shard->lock)) {
+        __atomic_add_fetch(&shard->contended, 1, __ATOMIC_RELAXED);
+        pthread_rwlock_wrlock(&shard->lock);
+    }
+    __atomic_add_fetch(&shard->acquired, 1, __ATOMIC_RELAXED);
+}
+
+MODULE_PRIVATE
+void clockLink(struct cacheShard *shard, struct cacheItem *item)
+{
+    struct cacheItem *hand = shard->clockHand;
+    if (!hand) {
+        item->clockPrev = item;
+        item->clockNext = item;
+        shard->clockHand = item;
+    } else {
+        // Just behind the hand, so the item is checked last.
+        item->clockNext = hand;
+        item->clockPrev = hand->clockPrev;
+        hand->clockPrev->clockNext = item;
+        hand->clockPrev = item;
+    }
+    shard->bytes += itemBytes(item);
+}
+
+MODULE_PRIVATE
+void clockUnlink(struct cacheShard *shard, struct cacheItem *item)
+{
+    if (item->clockNext == item) {
+        shard->clockHand = NULL;
+    } else {
+        item->clockPrev->clockNext = item->clockNext;
+        item->clockNext->clockPrev = item->clockPrev;
+        if (shard->clockHand == item) {
+            shard->clockHand = item->clockNext;
+        }
+    }
+    shard->bytes -= itemBytes(item);
+}
+
+MODULE_PRIVATE
+void drop(struct cacheShard *shard, const struct tablePosition *position)
+{
+    struct cacheItem *item = tableRemove(&shard->table, position);
+    clockUnlink(shard, item);
+    wheelRemove(&shard->wheel, item);
+    freeItem(shard, item);
+}
+
+// Called by the wheel, which already forgot the item.
+MODULE_PRIVATE
+void expireItem(void *context, struct cacheItem *item)
+{
+    struct cacheShard *shard = (struct cacheShard *)context;
+    struct tablePosition position;
+    if (!tableFind(&shard->table, item->hash, item->key, item->keyLength, &position, NULL)) {
+        LOG(LError, "Cache item is missing in the table");
+        return;
+    }
+    tableRemove(&shard->table, &position);
+    clockUnlink(shard, item);
+    freeItem(shard, item);
+    ++shard->expirations;
+}
+
+// Expects the shard to be locked for writing.
+MODULE_PRIVATE
+void expire(struct cacheShard *shard)
+{
+    wheelAdvance(&shard->wheel, clockNow(), expireItem, shard);
+}
+
+MODULE_PRIVATE
+int overLimit(const struct cacheShard *shard)
+{
+    return tableSize(&shard->table) > shard->maxEntries || shard->bytes > shard->maxBytes;
+}
+
+// Expects the shard to be locked for writing.
+MODULE_PRIVATE
+void evict(struct cacheShard *shard)
+{
+    uint64_t now = clockNow();
+
+    while (shard->clockHand && overLimit(shard)) {
+        struct cacheItem *item = shard->clockHand;
+        if (item->referenced && item->timeOfDeath >= now) {
+            item->referenced = 0;
+            shard->clockHand = item->clockNext;
+            continue;
+        }
+
+        struct tablePosition position;
+        if (!tableFind(&shard->table, item->hash, item->key, item->keyLength, &position, NULL)) {
+            LOG(LError, "Cache item is missing in the table");
+            return;
+        }
+        drop(shard, &position);
+        ++shard->evictions;
+    }
+}
+
+// The shares add up to the limit exactly, the first shards take the
+// remainder. A limit of 0 means unlimited.
+MODULE_PRIVATE
+size_t shareOf(size_t limit, size_t shard, size_t shardCount)
+{
+    if (!limit) {
+        return SIZE_MAX;
+    }
+    return limit / shardCount + (shard < limit % shardCount);
+}
+
+MODULE_PRIVATE
+void shardsClean(struct cache *cache)
+{
+    for (size_t s = 0; s < cache->shardCount; ++s) {
+        struct cacheShard *shard = &cache->shards[s];
+        // Large items live outside of the slab chunks.
+        while (shard->clockHand) {
+            struct cacheItem *item = shard->clockHand;
+            clockUnlink(shard, item);
+            freeItem(shard, item);
+        }
+        tableClean(&shard->table, NULL);
+        slabClean(&shard->slab);
+        pthread_rwlock_destroy(&shard->lock);
+    }
+    free(cache->shards);
+    cache->shards = NULL;
+    cache->shardCount = 0;
+}
+
+// The capacity is the expected number of items of the whole cache.
+MODULE_PRIVATE
+int shardsInit(struct cache *cache, size_t shardCount, size_t capacity)
+{
+    cache->shards = (struct cacheShard *)calloc(shardCount, sizeof(struct cacheShard));
+    if (!cache->shards) {
+        LOG(LFatal, "Allocation failed (%zu bytes)", shardCount * sizeof(struct cacheShard));
+        return 1;
+    }
+
+    for (size_t s = 0; s < shardCount; ++s) {
+        struct cacheShard *shard = &cache->shards[s];
+        shard->maxEntries = shareOf(cache->maxEntries, s, shardCount);
+        shard->maxBytes = shareOf(cache->maxBytes, s, shardCount);
+        pthread_rwlock_init(&shard->lock, NULL);
+        wheelInit(&shard->wheel, clockNow());
+        slabInit(&shard->slab, cache->hugePages);
+        cache->shardCount = s + 1;
+        if (tableInit(&shard->table, capacity / shardCount + 1)) {
+            shardsClean(cache);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Snapshot items keep their hashes and absolute expiry, the snapshot
+// never holds the same key twice. Runs before the pipeline starts.
+MODULE_PRIVATE
+void restore(struct cache *cache, const struct snapshot *snapshot)
+{
+    uint64_t now = clockNow();
+    size_t count = snapshotCount(snapshot);
+    size_t restored = 0;
+
+    for (size_t i = 0; i < count; ++i) {
+        struct cacheItem item;
+        if (snapshotItem(snapshot, i, &item)) {
+            LOG(LWarn, "Corrupted snapshot item %zu", i);
+            continue;
+        }
+        if (item.timeOfDeath < now) {
+            continue;
+        }
+        struct cacheShard *shard = &cache->shards[shardIndex(cache, item.hash)];
+        struct cacheItem *copy = allocItem(shard, item.key, item.keyLength, item.response, item.responseLength);
+        if (!copy) {
+            break;
+        }
+        copy->responseCode = item.responseCode;
+        copy->timeOfDeath = item.timeOfDeath;
+        copy->hash = item.hash;
+        copy->referenced = 0;
+        if (tableInsert(&shard->table, copy, NULL)) {
+            freeItem(shard, copy);
+            break;
+        }
+        clockLink(shard, copy);
+        wheelAdd(&shard->wheel, copy);
+        ++restored;
+    }
+    for (size_t s = 0; s < cache->shardCount; ++s) {
+        evict(&cache->shards[s]);
+    }
+    LOG(LInfo, "Cache restored %zu of %zu items from the snapshot", restored, count);
 }
 
 MODULE_PRIVATE
@@ -47,153 +350,514 @@ int loadConfig(struct module *module, const struct config *cfg, const char *sect
         return -1;
     }
 
-    int rv;
-    if ((rv = configValue(cfg, section, "Timeout", CfgInteger, &cache->timeout))) {
+    int timeout = defaultTimeout;
+    int timeoutMs = 0;
+    int bucketCount = defaultBucketCount;
+    int maxEntries = 0;
+    size_t maxBytes = cache->maxBytes;
+    int hugePages = cache->hugePages;
+    int shards = defaultShards;
+    const char *snapshotFile = NULL;
+    struct configField fields[] = {
+        { "Timeout", CfgInteger, &timeout, 0 },
+        { "TimeoutMs", CfgCount, &timeoutMs, 0 },
+        { "BucketCount", CfgInteger, &bucketCount, 0 },
+        { "MaxEntries", CfgCount, &maxEntries, 0 },
+        { "MaxBytes", CfgSize, &maxBytes, 0 },
+        { "HugePages", CfgBool, &hugePages, 0 },
+        { "Shards", CfgCount, &shards, 0 },
+        { "SnapshotFile", CfgString, &snapshotFile, 0 }
+    };
+    configFields(cfg, section, fields, sizeof(fields) / sizeof(*fields));
+
+    if (fields[0].status) {
         LOG(LWarn, "Could not read value Timeout, using default = %d", defaultTimeout);
     }
+    // Negative timeouts are treated as 0.
+    cache->timeout = timeout > 0 ? (uint64_t)timeout * 1000 : 0;
+
+    // Overrides Timeout.
+    if (fields[1].status == 0) {
+        cache->timeout = (uint64_t)timeoutMs;
+    } else if (fields[1].status == 3) {
+        LOG(LWarn, "Could not read value TimeoutMs, using Timeout");
+    }
 
-    int bucketCount;
-    if ((rv = configValue(cfg, section, "BucketCount", CfgInteger, &bucketCount))) {
+    if (fields[2].status) {
         LOG(LWarn, "Could not read value BucketCount, using default = %d", defaultBucketCount);
-        bucketCount = defaultBucketCount;
     }
 
     if (bucketCount < 0) {
         return 3;
     }
-    if ((size_t)bucketCount != cache->bucketCount || !cache->buckets) {
-        cache->bucketCount = bucketCount;
-        void *buckets = realloc(cache->buckets, cache->bucketCount * sizeof(struct bucket));
-        if (!buckets) {
-            LOG(LFatal, "Allocation failed (%zu bytes)", cache->bucketCount * sizeof(struct bucket));
+
+    // 0 means unlimited.
+    if (fields[3].status == 0) {
+        cache->maxEntries = maxEntries;
+    } else if (fields[3].status == 3) {
+        LOG(LWarn, "Invalid value for MaxEntries");
+        return 3;
+    }
+
+    if (fields[4].status == 3) {
+        LOG(LWarn, "Invalid value for MaxBytes");
+        return 3;
+    }
+    cache->maxBytes = maxBytes;
+
+    if (fields[5].status == 3) {
+        LOG(LWarn, "Could not read value HugePages, using normal pages");
+    }
+    cache->hugePages = hugePages;
+
+    if (fields[6].status == 3) {
+        LOG(LWarn, "Could not read value Shards, using default = %d", defaultShards);
+    }
+    if (shards < 1 || shards > maxShards) {
+        LOG(LWarn, "Invalid value for Shards: %d", shards);
+        return 3;
+    }
+    size_t shardCount = 1;
+    while (shardCount < (size_t)shards) {
+        shardCount *= 2;
+    }
+
+    if (snapshotFile) {
+        free(cache->snapshotFile);
+        cache->snapshotFile = strdup(snapshotFile);
+        if (!cache->snapshotFile) {
+            LOG(LFatal, "Allocation failed (%zu bytes)", strlen(snapshotFile) + 1);
             return -1;
         }
-        cache->buckets = (struct bucket *)buckets;
     }
 
-    memset(cache->buckets, 0, cache->bucketCount * sizeof(struct bucket));
+    cache->bucketCount = bucketCount;
+    shardsClean(cache);
+
+    struct snapshot *snapshot = cache->snapshotFile ? snapshotOpen(cache->snapshotFile) : NULL;
+    size_t capacity = cache->bucketCount;
+    if (snapshot && snapshotCount(snapshot) > capacity) {
+        capacity = snapshotCount(snapshot);
+    }
+    if (shardsInit(cache, shardCount, capacity)) {
+        snapshotClose(snapshot);
+        return -1;
+    }
+    if (snapshot) {
+        restore(cache, snapshot);
+        snapshotClose(snapshot);
+    }
     return 0;
 }
 
+// Expects the shard to be locked for reading at least. Expired items are
+// reported as missing, the timer wheel drops them. Leaves an insert hint
+// in the query when the item is missing.
 MODULE_PRIVATE
-size_t hash(const char *key)
+struct cacheItem *lookup(struct cacheShard *shard, struct query *query)
 {
-    const size_t base = 31;
-    size_t h = 0;
-    for (size_t coef = 1; *key; ++key) {
-        h += *key * coef;
-        coef *= base;
+    struct cacheItem *item = tableFind(&shard->table,
+                                       queryHash(query),
+                                       query->query,
+                                       query->queryLength,
+                                       NULL,
+                                       &query->insertHint);
+    if (item && item->timeOfDeath < clockNow()) {
+        item = NULL;
+    }
+    if (item) {
+        __atomic_store_n(&item->referenced, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&shard->hits, 1, __ATOMIC_RELAXED);
+    } else {
+        __atomic_add_fetch(&shard->misses, 1, __ATOMIC_RELAXED);
     }
-    return h;
+    return item;
 }
 
+// Expects the shard to be locked for writing. Drops the item in case it
+// expired, returns it otherwise.
 MODULE_PRIVATE
-struct cacheItem *find(struct cache *cache, const char *key)
+struct cacheItem *purge(struct cacheShard *shard, struct query *query)
 {
-    size_t bucketId = hash(key) % cache->bucketCount;
-    time_t now = time(NULL);
-
-    struct cacheItem **item = &cache->buckets[bucketId].first; 
-    while (*item) {
-        if ((*item)->timeOfDeath < now) {
-            struct cacheItem *toBeFreed = *item;
-            *item = (*item)->next;
-            free(toBeFreed->key);
-            free(toBeFreed->response);
-            free(toBeFreed);
-            continue;
-        }
-        if (strcmp(key, (*item)->key) == 0) {
-            return *item;
-        }
-        item = &(*item)->next;
+    struct tablePosition position;
+    struct cacheItem *item = tableFind(&shard->table,
+                                       queryHash(query),
+                                       query->query,
+                                       query->queryLength,
+                                       &position,
+                                       &query->insertHint);
+    if (item && item->timeOfDeath < clockNow()) {
+        drop(shard, &position);
+        ++shard->expirations;
+        return NULL;
     }
-    if (!cache->buckets[bucketId].first) {
-        cache->buckets[bucketId].last = NULL;
-    }
-    return NULL;
+    return item;
 }
 
 MODULE_PRIVATE
 void process(struct module *module, struct query *query)
 {
     struct cache *cache = (struct cache *)module->privateData;
-    if (!cache) {
+    if (!cache || !cache->shards) {
         query->responseCode = RCError;
         return;
     }
 
-    struct cacheItem *item = find(cache, query->query);
+    struct cacheShard *shard = &cache->shards[shardIndex(cache, queryHash(query))];
+    readLock(shard);
+    struct cacheItem *item = lookup(shard, query);
     if (!item) {
+        pthread_rwlock_unlock(&shard->lock);
         query->responseCode = RCSuccess;
         return;
     }
 
-    if (query->responseCleanup)
-        query->responseCleanup(query);
-
-    query->response = (char *)malloc(item->responseLength + 1);
-    if (!query->response) {
-        LOG(LFatal, "Allocation failed (%zu bytes)", item->responseLength + 1);
+    char *response = queryReserveResponse(query, item->responseLength + 1);
+    if (!response) {
+        pthread_rwlock_unlock(&shard->lock);
         query->responseCode = RCError;
         return;
     }
-    strcpy(query->response, item->response);
+    memcpy(response, item->response, item->responseLength + 1);
+    query->responseLength = item->responseLength;
+    pthread_rwlock_unlock(&shard->lock);
     query->responseCode = RCDone;
-    query->responseCleanup = responseCleanup;
+}
+
+// Expects the shard to be locked for writing.
+MODULE_PRIVATE
+void store(struct cache *cache, struct cacheShard *shard, struct query *query)
+{
+    // A valid hint from process() means the item is still missing.
+    if (!tableHintValid(&shard->table, &query->insertHint) && purge(shard, query)) {
+        return;
+    }
+
+    // A decorated response is joined here, the cache needs one string.
+    const char *response = queryFlattenResponse(query);
+    size_t responseLength = response ? query->responseLength : 0;
+    if (!response) {
+        response = "";
+    }
+    struct cacheItem *newItem = allocItem(shard, query->query, query->queryLength, response, responseLength);
+    if (!newItem) {
+        return;
+    }
+    newItem->responseCode = query->responseCode;
+    newItem->timeOfDeath = clockNow() + cache->timeout;
+    newItem->hash = queryHash(query);
+    newItem->referenced = 0;
+
+    if (tableInsert(&shard->table, newItem, &query->insertHint)) {
+        freeItem(shard, newItem);
+        return;
+    }
+    clockLink(shard, newItem);
+    wheelAdd(&shard->wheel, newItem);
+    ++shard->inserts;
+    evict(shard);
 }
 
 MODULE_PRIVATE
 void postProcess(struct module *module, struct query *query)
 {
     struct cache *cache = (struct cache *)module->privateData;
-    if (!cache) {
+    if (!cache || !cache->shards) {
         query->responseCode = RCError;
         return;
     }
-    struct cacheItem *item = find(cache, query->query);
 
-    if (!item) {
-        size_t bucketId = hash(query->query) % cache->bucketCount;
-        time_t now = time(NULL);
+    struct cacheShard *shard = &cache->shards[shardIndex(cache, queryHash(query))];
+    writeLock(shard);
+    expire(shard);
+    store(cache, shard, query);
+    pthread_rwlock_unlock(&shard->lock);
+}
 
-        struct cacheItem *newItem = (struct cacheItem *)malloc(sizeof(struct cacheItem));
-        if (!newItem) {
-            LOG(LFatal, "Allocation failed (%zu bytes)", sizeof(struct cacheItem));
-            return;
+struct shardRef {
+    size_t shard;
+    size_t index;
+};
+
+MODULE_PRIVATE
+int compareShardRefs(const void *a, const void *b)
+{
+    const struct shardRef *left = (const struct shardRef *)a;
+    const struct shardRef *right = (const struct shardRef *)b;
+    if (left->shard != right->shard) {
+        return left->shard < right->shard ? -1 : 1;
+    }
+    return left->index < right->index ? -1 : left->index > right->index;
+}
+
+// Orders the queries taking part in the stage by their shard, so that
+// every shard is locked once per batch.
+MODULE_PRIVATE
+struct shardRef *groupByShard(struct cache *cache, struct batch *batch, size_t *count)
+{
+    struct shardRef *refs = (struct shardRef *)batchAlloc(batch, batch->count * sizeof(struct shardRef));
+    if (!refs) {
+        return NULL;
+    }
+
+    *count = 0;
+    for (size_t i = 0; i < batch->count; ++i) {
+        if (!batchSkips(batch, i)) {
+            refs[*count].shard = shardIndex(cache, queryHash(&batch->queries[i]));
+            refs[*count].index = i;
+            ++*count;
         }
-        size_t queryLength = strlen(query->query);
-        newItem->key = (char *)malloc(queryLength + 1);
-        if (!newItem->key) {
-            LOG(LFatal, "Allocation failed (%zu bytes)", queryLength + 1);
-            free(newItem);
-            return;
+    }
+    qsort(refs, *count, sizeof(struct shardRef), compareShardRefs);
+    return refs;
+}
+
+MODULE_PRIVATE
+size_t shardRunEnd(const struct shardRef *refs, size_t begin, size_t count)
+{
+    size_t end = begin;
+    while (end < count && refs[end].shard == refs[begin].shard) {
+        ++end;
+    }
+    return end;
+}
+
+MODULE_PRIVATE
+void processBatch(struct module *module, struct batch *batch)
+{
+    struct cache *cache = (struct cache *)module->privateData;
+    if (!cache || !cache->shards) {
+        for (size_t i = 0; i < batch->count; ++i) {
+            if (!batchSkips(batch, i)) {
+                batch->queries[i].responseCode = RCError;
+            }
         }
-        size_t responseLength = strlen(query->response);
-        newItem->response = (char *)malloc(responseLength + 1);
-        if (!newItem->response) {
-            LOG(LFatal, "Allocation failed (%zu bytes)", responseLength + 1);
-            free(newItem->key);
-            free(newItem);
-            return;
+        return;
+    }
+
+    size_t count;
+    struct shardRef *refs = groupByShard(cache, batch, &count);
+    struct cacheItem **items = refs ? (struct cacheItem **)batchAlloc(batch, batch->count * sizeof(struct cacheItem *)) : NULL;
+    if (!items) {
+        for (size_t i = 0; i < batch->count; ++i) {
+            if (!batchSkips(batch, i)) {
+                process(module, &batch->queries[i]);
+            }
         }
-        strcpy(newItem->key, query->query);
-        if (query->response) {
-            strcpy(newItem->response, query->response);
-        } else {
-            newItem->response[0] = '\0';
+        return;
+    }
+
+    for (size_t begin = 0, end; begin < count; begin = end) {
+        end = shardRunEnd(refs, begin, count);
+        struct cacheShard *shard = &cache->shards[refs[begin].shard];
+
+        readLock(shard);
+        size_t total = 0;
+        for (size_t r = begin; r < end; ++r) {
+            struct cacheItem *item = lookup(shard, &batch->queries[refs[r].index]);
+            items[r] = item;
+            if (item) {
+                total += item->responseLength + 1;
+            }
         }
-        newItem->responseCode = query->responseCode;
-        newItem->responseLength = responseLength;
-        newItem->timeOfDeath = now + cache->timeout;
-        newItem->next = cache->buckets[bucketId].first;
 
-        cache->buckets[bucketId].first = newItem;
-        if (!cache->buckets[bucketId].last)
-            cache->buckets[bucketId].last = newItem;
+        // Hits are copied while the shard is still locked.
+        char *out = total ? (char *)batchAlloc(batch, total) : NULL;
+        for (size_t r = begin; r < end; ++r) {
+            struct query *query = &batch->queries[refs[r].index];
+            if (!items[r]) {
+                query->responseCode = RCSuccess;
+                continue;
+            }
+            if (!out) {
+                query->responseCode = RCError;
+                continue;
+            }
+
+            memcpy(out, items[r]->response, items[r]->responseLength + 1);
+            querySetResponse(query, out, items[r]->responseLength, items[r]->responseLength + 1);
+            query->responseCode = RCDone;
+            out += items[r]->responseLength + 1;
+        }
+        pthread_rwlock_unlock(&shard->lock);
+    }
+}
+
+MODULE_PRIVATE
+void postProcessBatch(struct module *module, struct batch *batch)
+{
+    struct cache *cache = (struct cache *)module->privateData;
+    if (!cache || !cache->shards) {
+        for (size_t i = 0; i < batch->count; ++i) {
+            if (!batchSkips(batch, i)) {
+                batch->queries[i].responseCode = RCError;
+            }
+        }
+        return;
+    }
+
+    size_t count;
+    struct shardRef *refs = groupByShard(cache, batch, &count);
+    if (!refs) {
+        for (size_t i = 0; i < batch->count; ++i) {
+            if (!batchSkips(batch, i)) {
+                postProcess(module, &batch->queries[i]);
+            }
+        }
+        return;
+    }
+
+    for (size_t begin = 0, end; begin < count; begin = end) {
+        end = shardRunEnd(refs, begin, count);
+        struct cacheShard *shard = &cache->shards[refs[begin].shard];
+
+        writeLock(shard);
+        expire(shard);
+        for (size_t r = begin; r < end; ++r) {
+            store(cache, shard, &batch->queries[refs[r].index]);
+        }
+        pthread_rwlock_unlock(&shard->lock);
+    }
+}
+
+MODULE_PRIVATE
+void reportContention(const struct cache *cache)
+{
+    size_t items = 0;
+    size_t acquired = 0;
+    size_t contended = 0;
+    for (size_t s = 0; s < cache->shardCount; ++s) {
+        const struct cacheShard *shard = &cache->shards[s];
+        LOG(LDebug, "Cache shard %zu: %zu items, %zu of %zu lock acquisitions contended",
+            s, tableSize(&shard->table), shard->contended, shard->acquired);
+        items += tableSize(&shard->table);
+        acquired += shard->acquired;
+        contended += shard->contended;
+    }
+    LOG(LInfo, "Cache shards: %zu, %zu items, %zu of %zu lock acquisitions contended",
+        cache->shardCount, items, contended, acquired);
+}
+
+struct cacheStats {
+    size_t hits;
+    size_t misses;
+    size_t inserts;
+    size_t expirations;
+    size_t evictions;
+    size_t bytes;
+    struct tableStats table;
+};
+
+// Sums the shards, every one is locked for reading in turn.
+MODULE_PRIVATE
+void collectStats(const struct cache *cache, struct cacheStats *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    for (size_t s = 0; s < cache->shardCount; ++s) {
+        struct cacheShard *shard = &cache->shards[s];
+        pthread_rwlock_rdlock(&shard->lock);
+        stats->hits += __atomic_load_n(&shard->hits, __ATOMIC_RELAXED);
+        stats->misses += __atomic_load_n(&shard->misses, __ATOMIC_RELAXED);
+        stats->inserts += shard->inserts;
+        stats->expirations += shard->expirations;
+        stats->evictions += shard->evictions;
+        stats->bytes += shard->bytes;
+        tableStatsAdd(&shard->table, &stats->table);
+        pthread_rwlock_unlock(&shard->lock);
+    }
+}
+
+MODULE_PRIVATE
+void printCounts(FILE *output, const size_t *counts, size_t count, const char *separator)
+{
+    for (size_t i = 0; i < count; ++i) {
+        fprintf(output, "%s%zu", i ? separator : "", counts[i]);
     }
 }
 
+// Lock acquisitions of every shard, or those which had to wait.
+MODULE_PRIVATE
+void printLockCounts(FILE *output, const struct cache *cache, int contended, const char *separator)
+{
+    for (size_t s = 0; s < cache->shardCount; ++s) {
+        const struct cacheShard *shard = &cache->shards[s];
+        size_t count = contended ?
+            __atomic_load_n(&shard->contended, __ATOMIC_RELAXED) :
+            __atomic_load_n(&shard->acquired, __ATOMIC_RELAXED);
+        fprintf(output, "%s%zu", s ? separator : "", count);
+    }
+}
+
+MODULE_PRIVATE
+void dump(const struct module *module, FILE *output, int json)
+{
+    const struct cache *cache = (const struct cache *)module->privateData;
+    if (!cache) {
+        return;
+    }
+
+    struct cacheStats stats;
+    collectStats(cache, &stats);
+    const struct tableStats *table = &stats.table;
+    if (json) {
+        fprintf(output,
+                "\"hits\":%zu,\"misses\":%zu,\"inserts\":%zu,\"expirations\":%zu,\"evictions\":%zu,"
+                "\"entries\":%zu,\"bytes\":%zu,\"capacity\":%zu,\"tombstones\":%zu,\"probeLengths\":[",
+                stats.hits, stats.misses, stats.inserts, stats.expirations, stats.evictions,
+                table->size, stats.bytes, table->capacity, table->tombstones);
+        printCounts(output, table->probeLengths, tableProbeLengths, ",");
+        fprintf(output, "],\"groupOccupancy\":[");
+        printCounts(output, table->groupOccupancy, tableGroupWidth + 1, ",");
+        fprintf(output, "],\"lockAcquired\":[");
+        printLockCounts(output, cache, 0, ",");
+        fprintf(output, "],\"lockContended\":[");
+        printLockCounts(output, cache, 1, ",");
+        fprintf(output, "]");
+        return;
+    }
+
+    fprintf(output, "%s hits %zu misses %zu inserts %zu expirations %zu evictions %zu\n",
+            module->name, stats.hits, stats.misses, stats.inserts, stats.expirations, stats.evictions);
+    fprintf(output, "%s entries %zu bytes %zu capacity %zu tombstones %zu\n",
+            module->name, table->size, stats.bytes, table->capacity, table->tombstones);
+    fprintf(output, "%s probeLengths ", module->name);
+    printCounts(output, table->probeLengths, tableProbeLengths, " ");
+    fprintf(output, "\n%s groupOccupancy ", module->name);
+    printCounts(output, table->groupOccupancy, tableGroupWidth + 1, " ");
+    fprintf(output, "\n%s lockAcquired ", module->name);
+    printLockCounts(output, cache, 0, " ");
+    fprintf(output, "\n%s lockContended ", module->name);
+    printLockCounts(output, cache, 1, " ");
+    fprintf(output, "\n");
+}
+
+MODULE_PRIVATE
+void reportStats(const struct cache *cache)
+{
+    struct cacheStats stats;
+    collectStats(cache, &stats);
+    const struct tableStats *table = &stats.table;
+    size_t lookups = stats.hits + stats.misses;
+
+    LOG(LInfo, "Cache: %zu hits, %zu misses (%.1f %% hit), %zu inserts, %zu expirations, %zu evictions",
+        stats.hits, stats.misses, lookups ? 100.0 * stats.hits / lookups : 0.0,
+        stats.inserts, stats.expirations, stats.evictions);
+    LOG(LInfo, "Cache: %zu entries, %zu bytes, %zu slots (%.1f %% full), %zu tombstones",
+        table->size, stats.bytes, table->capacity,
+        table->capacity ? 100.0 * table->size / table->capacity : 0.0, table->tombstones);
+
+    // Both lists have fewer than 10 counts.
+    char probes[16 * 21], groups[16 * 21];
+    int used = 0;
+    for (size_t i = 0; i < tableProbeLengths; ++i) {
+        used += snprintf(probes + used, sizeof(probes) - used, "%s%zu", i ? " " : "", table->probeLengths[i]);
+    }
+    used = 0;
+    for (size_t i = 0; i <= tableGroupWidth; ++i) {
+        used += snprintf(groups + used, sizeof(groups) - used, "%s%zu", i ? " " : "", table->groupOccupancy[i]);
+    }
+    LOG(LInfo, "Cache: items by groups probed: %s; groups by full slots: %s", probes, groups);
+}
 
 MODULE_PRIVATE
 void cleanup(struct module *module)
@@ -206,17 +870,21 @@ void cleanup(struct module *module)
         return;
     }
 
-    for (size_t i = 0; i != cache->bucketCount; ++i) {
-        while (cache->buckets[i].first) {
-            struct cacheItem *item = cache->buckets[i].first;
-            cache->buckets[i].first = item->next;
-
-            free(item->key);
-            free(item->response);
-            free(item);
+    reportContention(cache);
+    reportStats(cache);
+    if (cache->snapshotFile && cache->shards) {
+        const struct cacheItem *clocks[maxShards];
+        for (size_t s = 0; s < cache->shardCount; ++s) {
+            clocks[s] = cache->shards[s].clockHand;
+        }
+        long saved = snapshotSave(cache->snapshotFile, clocks, cache->shardCount, clockNow());
+        if (saved >= 0) {
+            LOG(LInfo, "Cache saved %ld items to the snapshot", saved);
         }
     }
-    free(cache->buckets);
+
+    shardsClean(cache);
+    free(cache->snapshotFile);
     free(cache);
 }
 
@@ -227,6 +895,11 @@ void moduleCache(struct module *module)
     module->loadConfig = loadConfig;
     module->process = process;
     module->postProcess = postProcess;
+    module->processBatch = processBatch;
+    module->postProcessBatch = postProcessBatch;
+    module->processFlags = 0;
+    module->postProcessFlags = 0;
+    module->dump = dump;
     module->cleanup = cleanup;
 
     struct cache *cache = (struct cache *)malloc(sizeof(struct cache));
@@ -235,12 +908,14 @@ void moduleCache(struct module *module)
         return;
     }
 
-    cache->timeout = 2;
+    cache->timeout = defaultTimeout * 1000;
     cache->bucketCount = 32;
-    cache->buckets = (struct bucket *)malloc(sizeof(struct bucket) * cache->bucketCount);
-    if (!cache->buckets) {
-        LOG(LFatal, "Allocation failed (%zu bytes)", sizeof(struct bucket) * cache->bucketCount);
-    }
-    memset(cache->buckets, 0, cache->bucketCount * sizeof(struct bucket));
+    cache->maxEntries = 0;
+    cache->maxBytes = 0;
+    cache->hugePages = 0;
+    cache->snapshotFile = NULL;
+    cache->shards = NULL;
+    cache->shardCount = 0;
+    shardsInit(cache, defaultShards, cache->bucketCount);
     module->privateData = cache;
 }
@@ -52,23 +52,24 @@ int loadConfig(struct module *module, const struct config *cfg, const char *sect
         return -1;
     }
 
-    int rv;
-    const char *color;
-    if ((rv = configValue(cfg, section, "Color", CfgString, &color))) {
+    const char *color = "default";
+    int bold = 0;
+    int underline = 0;
+    struct configField fields[] = {
+        { "Color", CfgString, &color, 0 },
+        { "Bold", CfgBool, &bold, 0 },
+        { "Underline", CfgBool, &underline, 0 }
+    };
+    configFields(cfg, section, fields, sizeof(fields) / sizeof(*fields));
+
+    if (fields[0].status) {
         LOG(LWarn, "Could not read value Color, using default = default");
-        color = "default";
     }
-
-    int bold;
-    if ((rv = configValue(cfg, section, "Bold", CfgBool, &bold))) {
+    if (fields[1].status) {
         LOG(LWarn, "Could not read value Bold, using default = false");
-        bold = 0;
     }
-
-    int underline;
-    if ((rv = configValue(cfg, section, "Underline", CfgBool, &underline))) {
+    if (fields[2].status) {
         LOG(LWarn, "Could not read value Underline, using default = false");
-        underline = 0;
     }
 
     int colorCode = 0;
@@ -104,13 +105,9 @@ int loadConfig(struct module *module, const struct config *cfg, const char *sect
     return 0;
 }
 
-MODULE_PRIVATE
-void responseCleanup(struct query *query)
-{
-    free(query->response);
-    query->response = NULL;
-}
-
+// The decoration is only referenced by the prefix and the suffix of the
+// response, the output joins them with the text. The text is borrowed,
+// the query or the current response stays where it is.
 MODULE_PRIVATE
 void decorate(struct module *module, struct query *query, int postProcess)
 {
@@ -120,34 +117,19 @@ void decorate(struct module *module, struct query *query, int postProcess)
         return;
     }
 
-    const char *source = postProcess ?
-        query->response :
-        query->query;
-    size_t length = strlen(source);
-
-    size_t responseLength = decoration->prefixLength
-                          + length
-                          + decoration->suffixLength
-                          + 1;
-    char *output = (char *) malloc(responseLength);
-    if (!output) {
-        LOG(LFatal, "Allocation failed (%zu bytes)", responseLength);
+    if (!postProcess) {
+        querySetResponse(query, (char *)query->query, query->queryLength, 0);
+    } else if (queryResponseSegmented(query) && !queryFlattenResponse(query)) {
         query->responseCode = RCError;
         return;
     }
-    char *p = output;
-    strcpy(p, decoration->prefix);
-    p += decoration->prefixLength;
-    strcpy(p, source);
-    p += length;
-    strcpy(p, decoration->suffix);
-
-    if (query->responseCleanup) {
-        query->responseCleanup(query);
-    }
-    query->response = output;
-    query->responseCleanup = responseCleanup;
 
+    // The borrowed text must not be changed in place.
+    query->responseCapacity = 0;
+    query->responsePrefix = decoration->prefix;
+    query->responsePrefixLength = decoration->prefixLength;
+    query->responseSuffix = decoration->suffix;
+    query->responseSuffixLength = decoration->suffixLength;
     query->responseCode = RCSuccess;
 }
 
@@ -183,6 +165,11 @@ void moduleDecorate(struct module *module)
     module->loadConfig = loadConfig;
     module->process = process;
     module->postProcess = postProcess;
+    module->processBatch = NULL;
+    module->postProcessBatch = NULL;
+    module->processFlags = ModulePure | ModuleOverwrites;
+    module->postProcessFlags = ModulePure;
+    module->dump = NULL;
     module->cleanup = cleanup;
 
     struct decoration *decoration = (struct decoration *)malloc(sizeof(struct decoration));
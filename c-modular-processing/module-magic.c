@@ -7,6 +7,18 @@ void process(struct module *module, struct query *query)
     query->responseCode = RCSuccess;
 }
 
+// One call for the whole batch instead of one per query.
+MODULE_PRIVATE
+void processBatch(struct module *module, struct batch *batch)
+{
+    (void)module;
+    for (size_t i = 0; i < batch->count; ++i) {
+        if (!batchSkips(batch, i)) {
+            batch->queries[i].responseCode = RCSuccess;
+        }
+    }
+}
+
 void moduleMagic(struct module *module)
 {
     module->privateData = NULL;
@@ -14,5 +26,10 @@ void moduleMagic(struct module *module)
     module->loadConfig = NULL;
     module->process = process;
     module->postProcess = NULL;
+    module->processBatch = processBatch;
+    module->postProcessBatch = NULL;
+    module->processFlags = ModulePure;
+    module->postProcessFlags = 0;
+    module->dump = NULL;
     module->cleanup = NULL;
 }
\ No newline at end of file
@@ -1,41 +1,67 @@
-#include <ctype.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "casemap.h"
 #include "config.h"
 #include "log.h"
 #include "module-toupper.h"
 
 MODULE_PRIVATE
-void responseCleanup(struct query *query)
+void process(struct module *module, struct query *query)
 {
-    free(query->response);
-    query->response = NULL;
+    (void)module;
+    size_t length = query->queryLength;
+    char *response = queryReserveResponse(query, length + 1);
+    if (!response) {
+        query->responseCode = RCError;
+        return;
+    }
+
+    caseToUpper(response, query->query, length);
+    response[length] = '\0';
+    query->responseLength = length;
+    query->responseCode = RCSuccess;
 }
 
+// Responses which are big enough are overwritten, the others are
+// placed into one block of the batch.
 MODULE_PRIVATE
-void process(struct module *module, struct query *query)
+void processBatch(struct module *module, struct batch *batch)
 {
     (void)module;
-    if (query->responseCleanup)
-        query->responseCleanup(query);
-
-    size_t length = strlen(query->query);
-    query->response = (char *)malloc(length + 1);
-    if (!query->response) {
-        LOG(LFatal, "Allocation failed (%zu bytes)", length + 1);
-        query->responseCode = RCError;
-        return;
+    size_t total = 0;
+    for (size_t i = 0; i < batch->count; ++i) {
+        const struct query *query = &batch->queries[i];
+        if (!batchSkips(batch, i) && query->responseCapacity <= query->queryLength) {
+            total += query->queryLength + 1;
+        }
     }
 
-    query->responseCleanup = responseCleanup;
+    char *out = total ? (char *)batchAlloc(batch, total) : NULL;
+    for (size_t i = 0; i < batch->count; ++i) {
+        struct query *query = &batch->queries[i];
+        if (batchSkips(batch, i)) {
+            continue;
+        }
+
+        size_t length = query->queryLength;
+        char *response = query->response;
+        if (query->responseCapacity <= length) {
+            if (!out) {
+                querySetResponse(query, "", 0, 0);
+                query->responseCode = RCError;
+                continue;
+            }
+            querySetResponse(query, out, length, length + 1);
+            response = out;
+            out += length + 1;
+        }
 
-    char *out = query->response;
-    for (const char *in = query->query; *in; ++in, ++out) {
-        *out = toupper(*in);
+        caseToUpper(response, query->query, length);
+        response[length] = '\0';
+        query->responseLength = length;
+        query->responseCode = RCSuccess;
     }
-    *out = '\0';
-    query->responseCode = RCSuccess;
 }
 
 void moduleToUpper(struct module *module)
@@ -45,5 +71,10 @@ void moduleToUpper(struct module *module)
     module->loadConfig = NULL;
     module->process = process;
     module->postProcess = NULL;
+    module->processBatch = processBatch;
+    module->postProcessBatch = NULL;
+    module->processFlags = ModulePure | ModuleOverwrites;
+    module->postProcessFlags = 0;
+    module->dump = NULL;
     module->cleanup = NULL;
 }
@@ -3,11 +3,22 @@
 
 #include <stddef.h>
 
+#include "batch.h"
 #include "query.h"
 #include "functions.h"
 
 #define MODULE_PRIVATE static
 
+// What a stage does to a query, used to plan the pipeline.
+enum moduleFlags {
+    // Only the response and the response code of the query are changed,
+    // nothing outside of the query is read or written.
+    ModulePure = 1,
+    // The response and the code do not depend on the previous ones,
+    // unless the stage fails.
+    ModuleOverwrites = 2
+};
+
 struct module {
 
     void *privateData;
@@ -17,6 +28,19 @@ struct module {
     processFn process;
     processFn postProcess;
 
+    // Optional, used instead of process/postProcess when present.
+    processBatchFn processBatch;
+    processBatchFn postProcessBatch;
+
+    // See moduleFlags, 0 for stages which have to run.
+    unsigned processFlags;
+    unsigned postProcessFlags;
+
+    // Optional, writes the state of the module to the statistics dumps,
+    // as the members of a JSON object when the last argument is set and
+    // as text lines otherwise.
+    moduleDumpFn dump;
+
     moduleCleanupFn cleanup;
 
 };
@@ -0,0 +1,40 @@
+#include "log.h"
+#include "pipeline.h"
+
+// Walks the chain from the end, so it is known for every stage whether
+// its response is overwritten before a stage with side effects can see it.
+static int dropDeadStages(struct module *stages, int count, int postProcess)
+{
+    const char *overwrittenBy = NULL;
+    int kept = count;
+    for (int m = count - 1; m >= 0; --m) {
+        unsigned flags = postProcess ? stages[m].postProcessFlags : stages[m].processFlags;
+
+        if (overwrittenBy && (flags & ModulePure)) {
+            LOG(LDebug, "Dropping %s, its response is overwritten by %s", stages[m].name, overwrittenBy);
+            for (int s = m; s + 1 < kept; ++s) {
+                stages[s] = stages[s + 1];
+            }
+            --kept;
+            continue;
+        }
+
+        if (!(flags & ModulePure)) {
+            overwrittenBy = NULL;
+        } else if (flags & ModuleOverwrites) {
+            overwrittenBy = stages[m].name;
+        }
+    }
+    return count - kept;
+}
+
+int pipelineOptimize(struct pipeline *pipeline)
+{
+    int dropped = dropDeadStages(pipeline->pre, pipeline->preSize, 0);
+    pipeline->preSize -= dropped;
+
+    int droppedPost = dropDeadStages(pipeline->post, pipeline->postSize, 1);
+    pipeline->postSize -= droppedPost;
+
+    return dropped + droppedPost;
+}
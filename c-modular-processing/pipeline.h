@@ -0,0 +1,17 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include "engine.h"
+
+/** Drop the stages whose work cannot be observed
+ *
+ *  A pure stage is dead when a later stage overwrites the response
+ *  and only pure stages run in between. The last stage of a chain
+ *  is always kept. The stages are planned by their moduleFlags.
+ *
+ *  @param pipeline The pipeline, its stages are compacted in place.
+ *  @return the number of stages dropped
+ */
+int pipelineOptimize(struct pipeline *pipeline);
+
+#endif
@@ -1,9 +1,137 @@
 #include <memory.h> 
+#include <stdlib.h>
 
+#include "arena.h"
+#include "hash.h"
+#include "log.h"
 #include "query.h"
 
+enum {
+    // Room for a decoration or similar without growing again.
+    responseHeadroom = 32
+};
+
 void initQuery(struct query *query)
 {
     memset(query, 0, sizeof(struct query));
     query->responseCode = RCSuccess;
 }
+
+size_t queryHash(struct query *query)
+{
+    if (!query->hashed) {
+        query->hash = hashBytes(query->query, query->queryLength);
+        query->hashed = 1;
+    }
+    return query->hash;
+}
+
+static void releaseResponse(struct query *query)
+{
+    free(query->response);
+    query->response = NULL;
+    query->responseLength = 0;
+    query->responseCapacity = 0;
+    query->responseOwned = 0;
+}
+
+static char *allocResponse(struct query *query, size_t size)
+{
+    char *response = query->arena ? (char *)arenaAlloc(query->arena, size) : (char *)malloc(size);
+    if (!response && !query->arena) {
+        LOG(LFatal, "Allocation failed (%zu bytes)", size);
+    }
+    return response;
+}
+
+static char *growResponse(struct query *query, size_t size)
+{
+    char *response = query->arena
+        ? (char *)arenaGrow(query->arena, query->response, query->responseCapacity, size)
+        : (char *)realloc(query->response, size);
+    if (!response && !query->arena) {
+        LOG(LFatal, "Allocation failed (%zu bytes)", size);
+    }
+    return response;
+}
+
+char *queryReserveResponse(struct query *query, size_t capacity)
+{
+    if (query->responseCapacity >= capacity && !queryResponseSegmented(query)) {
+        return query->response;
+    }
+
+    // The kept content may be longer than the requested capacity.
+    size_t length = query->responsePrefixLength + query->responseSuffixLength;
+    length += query->response ? query->responseLength : 0;
+    if (capacity < length + 1) {
+        capacity = length + 1;
+    }
+    size_t grown = capacity + capacity / 2 + responseHeadroom;
+    if (query->responseOwned && !queryResponseSegmented(query)) {
+        char *response = growResponse(query, grown);
+        if (!response) {
+            return NULL;
+        }
+        query->response = response;
+        query->responseCapacity = grown;
+        return response;
+    }
+
+    char *response = allocResponse(query, grown);
+    if (!response) {
+        return NULL;
+    }
+    char *out = response;
+    if (query->responsePrefixLength) {
+        memcpy(out, query->responsePrefix, query->responsePrefixLength);
+        out += query->responsePrefixLength;
+    }
+    if (query->response && query->responseLength) {
+        memcpy(out, query->response, query->responseLength);
+        out += query->responseLength;
+    }
+    if (query->responseSuffixLength) {
+        memcpy(out, query->responseSuffix, query->responseSuffixLength);
+    }
+    response[length] = '\0';
+
+    if (query->responseCleanup) {
+        query->responseCleanup(query);
+    }
+    query->responsePrefix = NULL;
+    query->responsePrefixLength = 0;
+    query->response = response;
+    query->responseLength = length;
+    query->responseSuffix = NULL;
+    query->responseSuffixLength = 0;
+    query->responseCapacity = grown;
+    query->responseOwned = 1;
+    query->responseCleanup = query->arena ? NULL : releaseResponse;
+    return response;
+}
+
+char *queryFlattenResponse(struct query *query)
+{
+    if (!queryResponseSegmented(query)) {
+        return query->response;
+    }
+    // A segmented response is never kept as it is.
+    return queryReserveResponse(query, 0);
+}
+
+void querySetResponse(struct query *query, char *response, size_t length, size_t capacity)
+{
+    if (query->responseCleanup) {
+        query->responseCleanup(query);
+        query->responseCleanup = NULL;
+    }
+    query->responsePrefix = NULL;
+    query->responsePrefixLength = 0;
+    query->response = response;
+    query->responseLength = length;
+    query->responseSuffix = NULL;
+    query->responseSuffixLength = 0;
+    query->responseCapacity = capacity;
+    query->responseOwned = 0;
+}
@@ -1,25 +1,109 @@
 #ifndef QUERY_H
 #define QUERY_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 #include "functions.h"
 
+struct arena;
+
 enum responseCode {
     RCError,
     RCDone,
     RCSuccess
 };
 
+// Left by a lookup which missed, so the insertion of the same query
+// can skip the search as long as the table has not changed meanwhile.
+struct insertHint {
+    size_t generation;
+    size_t removals;
+    size_t index;
+};
+
 struct query {
+    // The query is not terminated by '\0', use queryLength.
     const char *query;
+    size_t queryLength;
+    // Computed once by queryHash.
+    size_t hash;
+    int hashed;
     queryCleanupFn queryCleanup;
 
+    // The response is the prefix, response and suffix together. Only
+    // the flat response without a prefix and a suffix is terminated by
+    // '\0', see queryFlattenResponse.
+    const char *responsePrefix;
+    size_t responsePrefixLength;
     char *response;
+    size_t responseLength;
+    const char *responseSuffix;
+    size_t responseSuffixLength;
+    // Bytes of the response buffer a module may overwrite, 0 in case
+    // the response must not be changed in place.
+    size_t responseCapacity;
+    // The buffer comes from queryReserveResponse and may be grown.
+    int responseOwned;
     enum responseCode responseCode;
+    // Only for responses which need more than the arena reset.
     queryCleanupFn responseCleanup;
+    // Responses are allocated from the arena when set, the engine
+    // resets it once the batch is written. Otherwise they are
+    // allocated on the heap and released by responseCleanup.
+    struct arena *arena;
+
+    struct insertHint insertHint;
 };
 
 void initQuery(struct query *);
 
+/** Get the hash of the query, it is computed only once.
+ *
+ *  @param query The query.
+ */
+size_t queryHash(struct query *query);
+
+static inline int queryResponseSegmented(const struct query *query)
+{
+    return query->responsePrefixLength || query->responseSuffixLength;
+}
+
+/** Make the response writable with room for at least capacity bytes
+ *
+ *  A flat response which is big enough is kept, an owned one is grown.
+ *  Otherwise the response is copied into a new owned buffer and the
+ *  previous one is released. The content is kept in all cases, new
+ *  buffers get some headroom for later modules. The buffer comes
+ *  from the arena of the query when it has one. The prefix and
+ *  the suffix become a part of the flat response.
+ *
+ *  @param query The query.
+ *  @param capacity The number of bytes including the terminating '\0'.
+ *  @return the response buffer or NULL in case the allocation fails,
+ *          the response is unchanged then
+ */
+char *queryReserveResponse(struct query *query, size_t capacity);
+
+/** Join the prefix, the response and the suffix
+ *
+ *  @param query The query.
+ *  @return the flat response terminated by '\0' or NULL in case
+ *          the allocation fails, the response is unchanged then
+ */
+char *queryFlattenResponse(struct query *query);
+
+/** Replace the response by memory the query does not own
+ *
+ *  The previous response including its prefix and suffix is released.
+ *
+ *  @param query The query.
+ *  @param response The response, terminated by '\0' unless
+ *                  a prefix or a suffix is set afterwards.
+ *  @param length The length of the response.
+ *  @param capacity Bytes of the response later modules may overwrite,
+ *                  0 for read-only responses.
+ */
+void querySetResponse(struct query *query, char *response, size_t length, size_t capacity);
+
 #endif
@@ -0,0 +1,165 @@
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "reader.h"
+
+enum {
+    readBufferSize = 1 << 20
+};
+
+struct reader {
+    int fd;
+
+    // Mapped file or the read buffer.
+    char *data;
+    size_t size;
+    size_t position;
+    int mapped;
+
+    size_t capacity;
+    int eof;
+};
+
+static int fill(struct reader *reader)
+{
+    if (reader->position) {
+        reader->size -= reader->position;
+        memmove(reader->data, reader->data + reader->position, reader->size);
+        reader->position = 0;
+    }
+
+    if (reader->size == reader->capacity) {
+        size_t capacity = reader->capacity * 2;
+        char *data = (char *)realloc(reader->data, capacity);
+        if (!data) {
+            LOG(LFatal, "Allocation failed (%zu bytes)", capacity);
+            return -1;
+        }
+        reader->data = data;
+        reader->capacity = capacity;
+    }
+
+    ssize_t rv;
+    do {
+        rv = read(reader->fd, reader->data + reader->size, reader->capacity - reader->size);
+    } while (rv < 0 && errno == EINTR);
+
+    if (rv < 0) {
+        LOG(LError, "Cannot read input");
+        return -1;
+    }
+    if (rv == 0) {
+        reader->eof = 1;
+    }
+    reader->size += rv;
+    return 0;
+}
+
+struct reader *readerOpen(const char *file)
+{
+    struct reader *reader = (struct reader *)calloc(1, sizeof(struct reader));
+    if (!reader) {
+        LOG(LFatal, "Allocation failed (%zu bytes)", sizeof(struct reader));
+        return NULL;
+    }
+
+    reader->fd = open(file, O_RDONLY);
+    if (reader->fd < 0) {
+        free(reader);
+        return NULL;
+    }
+
+    struct stat info;
+    if (!fstat(reader->fd, &info) && S_ISREG(info.st_mode)) {
+        if (!info.st_size) {
+            reader->mapped = 1;
+            reader->eof = 1;
+            return reader;
+        }
+        void *data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, reader->fd, 0);
+        if (data != MAP_FAILED) {
+            posix_madvise(data, info.st_size, POSIX_MADV_SEQUENTIAL);
+            reader->data = (char *)data;
+            reader->size = info.st_size;
+            reader->mapped = 1;
+            reader->eof = 1;
+            return reader;
+        }
+        LOG(LDebug, "Cannot map file '%s', reading it instead", file);
+    }
+
+    reader->capacity = readBufferSize;
+    reader->data = (char *)malloc(reader->capacity);
+    if (!reader->data) {
+        LOG(LFatal, "Allocation failed (%zu bytes)", reader->capacity);
+        close(reader->fd);
+        free(reader);
+        return NULL;
+    }
+    return reader;
+}
+
+int readerNext(struct reader *reader, const char **line, size_t *length)
+{
+    char *begin = NULL;
+    char *end = NULL;
+
+    for (;;) {
+        begin = reader->data + reader->position;
+        size_t available = reader->size - reader->position;
+
+        // memchr is vectorized by the C library.
+        end = (char *)memchr(begin, '\n', available);
+        if (end) {
+            reader->position = end - reader->data + 1;
+            break;
+        }
+        if (reader->eof) {
+            if (!available) {
+                return 0;
+            }
+            end = begin + available;
+            reader->position = reader->size;
+            break;
+        }
+        if (fill(reader)) {
+            return -1;
+        }
+    }
+
+    while (end != begin && isspace((unsigned char)end[-1])) {
+        --end;
+    }
+
+    *line = begin;
+    *length = end - begin;
+    return 1;
+}
+
+int readerStable(const struct reader *reader)
+{
+    return reader->mapped;
+}
+
+void readerClose(struct reader *reader)
+{
+    if (!reader) {
+        return;
+    }
+    if (reader->mapped) {
+        if (reader->data) {
+            munmap(reader->data, reader->size);
+        }
+    } else {
+        free(reader->data);
+    }
+    close(reader->fd);
+    free(reader);
+}
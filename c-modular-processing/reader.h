@@ -0,0 +1,44 @@
+#ifndef READER_H
+#define READER_H
+
+#include <stddef.h>
+
+struct reader;
+
+/** Open the input file
+ *
+ *  Regular files are mapped into memory, anything else (pipes, devices)
+ *  is read through a large buffer.
+ *
+ *  @param file The path to the input file.
+ *  @return the reader or NULL in case the file cannot be opened
+ */
+struct reader *readerOpen(const char *file);
+
+/** Get the next line without the line break and trailing white spaces
+ *
+ *  @param reader The reader.
+ *  @param line The output parameter for the beginning of the line,
+ *              the line is not terminated by '\0'.
+ *  @param length The output parameter for the length of the line.
+ *  @return 1 in case a line was read
+ *          0 at the end of the input
+ *          -1 in case of an error
+ */
+int readerNext(struct reader *reader, const char **line, size_t *length);
+
+/** Check how long the lines stay valid
+ *
+ *  @param reader The reader.
+ *  @return nonzero in case the lines stay valid until readerClose,
+ *          0 in case they are valid only until the next readerNext
+ */
+int readerStable(const struct reader *reader);
+
+/** Release all resources hold by the reader.
+ *
+ *  @param reader The reader.
+ */
+void readerClose(struct reader *reader);
+
+#endif
@@ -0,0 +1,425 @@
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "batch.h"
+#include "engine.h"
+#include "log.h"
+#include "module.h"
+#include "stats.h"
+
+enum {
+    // Sub-buckets per power of two, latencies are kept with a relative
+    // error of about 6 %, as in HDR histograms.
+    histogramSubBits = 4,
+    histogramSub = 1 << histogramSubBits,
+    histogramBuckets = (64 - histogramSubBits + 1) * histogramSub,
+    // RCError, RCDone, RCSuccess and unknown codes.
+    codeCount = 4
+};
+
+struct histogram {
+    uint64_t max;
+    uint64_t buckets[histogramBuckets];
+};
+
+struct stageCounters {
+    uint64_t codes[codeCount];
+    // Latencies of the calls for single queries.
+    struct histogram query;
+    // Latencies of the calls for whole batches, which do not tell
+    // how long any one query took.
+    struct histogram batch;
+};
+
+// Written by one thread only, read by the dumps.
+struct statsBlock {
+    struct statsBlock *next;
+    struct stageCounters stages[];
+};
+
+struct stats {
+    int stageCount;
+    int preSize;
+    const struct module **modules;
+    char *file;
+    enum statsFormat format;
+
+    // Converts the ticks of statsClock to nanoseconds.
+    uint64_t startTicks;
+    struct timespec start;
+
+    // Registration of the threads and the dumps.
+    pthread_mutex_t lock;
+    struct statsBlock *blocks;
+    struct sigaction previous;
+};
+
+static __thread struct statsBlock *threadBlock;
+static __thread const struct stats *threadOwner;
+// Set by the signal handler, lock-free atomics are safe there.
+static int dumpRequested;
+
+static void requestDump(int signal)
+{
+    (void)signal;
+    __atomic_store_n(&dumpRequested, 1, __ATOMIC_RELAXED);
+}
+
+// Only the owner thread writes, the dumps may read at any time.
+static void add(uint64_t *counter, uint64_t count)
+{
+    __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + count, __ATOMIC_RELAXED);
+}
+
+static size_t bucketIndex(uint64_t ticks)
+{
+    if (ticks < histogramSub) {
+        return ticks;
+    }
+    int shift = 63 - __builtin_clzll(ticks) - histogramSubBits;
+    return ((size_t)(shift + 1) << histogramSubBits) | ((ticks >> shift) & (histogramSub - 1));
+}
+
+// The highest value which falls into the bucket.
+static uint64_t bucketHigh(size_t index)
+{
+    if (index < 2 * histogramSub) {
+        return index;
+    }
+    int shift = (int)(index >> histogramSubBits) - 1;
+    uint64_t low = (uint64_t)((index & (histogramSub - 1)) | histogramSub) << shift;
+    return low + ((uint64_t)1 << shift) - 1;
+}
+
+static size_t codeIndex(int code)
+{
+    switch (code) {
+    case RCError:   return 0;
+    case RCDone:    return 1;
+    case RCSuccess: return 2;
+    default:        return 3;
+    }
+}
+
+static struct statsBlock *threadStats(struct stats *stats)
+{
+    if (threadOwner == stats) {
+        return threadBlock;
+    }
+
+    size_t size = sizeof(struct statsBlock) + stats->stageCount * sizeof(struct stageCounters);
+    struct statsBlock *block = (struct statsBlock *)calloc(1, size);
+    if (!block) {
+        LOG(LFatal, "Allocation failed (%zu bytes)", size);
+    } else {
+        pthread_mutex_lock(&stats->lock);
+        block->next = stats->blocks;
+        stats->blocks = block;
+        pthread_mutex_unlock(&stats->lock);
+    }
+
+    // A thread which cannot allocate does not try again.
+    threadOwner = stats;
+    threadBlock = block;
+    return block;
+}
+
+static void record(struct histogram *histogram, uint64_t ticks)
+{
+    add(&histogram->buckets[bucketIndex(ticks)], 1);
+    if (ticks > histogram->max) {
+        __atomic_store_n(&histogram->max, ticks, __ATOMIC_RELAXED);
+    }
+}
+
+void statsQuery(struct stats *stats, int stage, int code, uint64_t ticks)
+{
+    struct statsBlock *block = threadStats(stats);
+    if (!block) {
+        return;
+    }
+
+    struct stageCounters *counters = &block->stages[stage];
+    add(&counters->codes[codeIndex(code)], 1);
+    record(&counters->query, ticks);
+}
+
+void statsBatch(struct stats *stats, int stage, const struct batch *batch, uint64_t ticks)
+{
+    struct statsBlock *block = threadStats(stats);
+    if (!block) {
+        return;
+    }
+
+    uint64_t codes[codeCount] = { 0 };
+    uint64_t count = 0;
+    for (size_t i = 0; i < batch->count; ++i) {
+        if (!batchSkips(batch, i)) {
+            ++codes[codeIndex(batch->queries[i].responseCode)];
+            ++count;
+        }
+    }
+    if (!count) {
+        return;
+    }
+
+    struct stageCounters *counters = &block->stages[stage];
+    for (size_t c = 0; c < codeCount; ++c) {
+        if (codes[c]) {
+            add(&counters->codes[c], codes[c]);
+        }
+    }
+    record(&counters->batch, ticks);
+}
+
+struct stats *statsStart(const struct pipeline *pipeline, const struct statsSettings *settings)
+{
+    struct stats *stats = (struct stats *)calloc(1, sizeof(struct stats));
+    int stageCount = pipeline->preSize + pipeline->postSize;
+    const struct module **modules = (const struct module **)calloc(stageCount ? stageCount : 1, sizeof(struct module *));
+    char *file = settings->file ? strdup(settings->file) : NULL;
+    if (!stats || !modules || (settings->file && !file)) {
+        LOG(LFatal, "Allocation failed (%zu bytes)", sizeof(struct stats));
+        free(stats);
+        free(modules);
+        free(file);
+        return NULL;
+    }
+
+    for (int m = 0; m < pipeline->preSize; ++m) {
+        modules[m] = &pipeline->pre[m];
+    }
+    for (int m = 0; m < pipeline->postSize; ++m) {
+        modules[pipeline->preSize + m] = &pipeline->post[m];
+    }
+    stats->stageCount = stageCount;
+    stats->preSize = pipeline->preSize;
+    stats->modules = modules;
+    stats->file = file;
+    stats->format = settings->format;
+    pthread_mutex_init(&stats->lock, NULL);
+
+    clock_gettime(CLOCK_MONOTONIC, &stats->start);
+    stats->startTicks = statsClock();
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = requestDump;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGUSR1, &action, &stats->previous)) {
+        LOG(LWarn, "Statistics cannot be requested by SIGUSR1");
+    }
+    return stats;
+}
+
+void statsPoll(struct stats *stats)
+{
+    if (__atomic_exchange_n(&dumpRequested, 0, __ATOMIC_RELAXED)) {
+        statsDump(stats);
+    }
+}
+
+static uint64_t samples(const struct histogram *histogram)
+{
+    uint64_t total = 0;
+    for (size_t b = 0; b < histogramBuckets; ++b) {
+        total += histogram->buckets[b];
+    }
+    return total;
+}
+
+static uint64_t percentile(const struct histogram *histogram, uint64_t total, double share)
+{
+    uint64_t rank = (uint64_t)(share * total);
+    if (rank < 1) {
+        rank = 1;
+    }
+    uint64_t seen = 0;
+    for (size_t b = 0; b < histogramBuckets; ++b) {
+        seen += histogram->buckets[b];
+        if (seen >= rank) {
+            uint64_t high = bucketHigh(b);
+            return high < histogram->max ? high : histogram->max;
+        }
+    }
+    return histogram->max;
+}
+
+// Prints p50, p99, p999 and max of the histogram, or dashes and null
+// in case it has no samples.
+static void dumpLatency(const struct histogram *histogram, double nsPerTick, int json, FILE *output)
+{
+    uint64_t total = samples(histogram);
+    if (!total) {
+        fprintf(output, json ? "null" : " - - - -");
+        return;
+    }
+
+    unsigned long long p50 = percentile(histogram, total, 0.5) * nsPerTick;
+    unsigned long long p99 = percentile(histogram, total, 0.99) * nsPerTick;
+    unsigned long long p999 = percentile(histogram, total, 0.999) * nsPerTick;
+    unsigned long long max = histogram->max * nsPerTick;
+    if (json) {
+        fprintf(output, "{\"p50\":%llu,\"p99\":%llu,\"p999\":%llu,\"max\":%llu}", p50, p99, p999, max);
+    } else {
+        fprintf(output, " %llu %llu %llu %llu", p50, p99, p999, max);
+    }
+}
+
+// A module running in several stages is dumped by the first one.
+static int firstStage(const struct stats *stats, int stage)
+{
+    const struct module *module = stats->modules[stage];
+    for (int s = 0; s < stage; ++s) {
+        if (stats->modules[s]->dump == module->dump
+            && stats->modules[s]->privateData == module->privateData) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void dumpModules(const struct stats *stats, FILE *output)
+{
+    int json = stats->format == StatsJson;
+    int first = 1;
+    for (int s = 0; s < stats->stageCount; ++s) {
+        const struct module *module = stats->modules[s];
+        if (!module->dump || !firstStage(stats, s)) {
+            continue;
+        }
+        if (json) {
+            fprintf(output, "%s\"%s\":{", first ? "" : ",", module->name);
+        }
+        module->dump(module, output, json);
+        if (json) {
+            fprintf(output, "}");
+        }
+        first = 0;
+    }
+}
+
+static void collectHistogram(const struct histogram *histogram, struct histogram *sum)
+{
+    for (size_t b = 0; b < histogramBuckets; ++b) {
+        sum->buckets[b] += __atomic_load_n(&histogram->buckets[b], __ATOMIC_RELAXED);
+    }
+    uint64_t max = __atomic_load_n(&histogram->max, __ATOMIC_RELAXED);
+    if (max > sum->max) {
+        sum->max = max;
+    }
+}
+
+// Sums the counters of all threads, expects the lock to be held.
+static void collect(const struct stats *stats, int stage, struct stageCounters *sum)
+{
+    memset(sum, 0, sizeof(*sum));
+    for (const struct statsBlock *block = stats->blocks; block; block = block->next) {
+        const struct stageCounters *counters = &block->stages[stage];
+        for (size_t c = 0; c < codeCount; ++c) {
+            sum->codes[c] += __atomic_load_n(&counters->codes[c], __ATOMIC_RELAXED);
+        }
+        collectHistogram(&counters->query, &sum->query);
+        collectHistogram(&counters->batch, &sum->batch);
+    }
+}
+
+void statsDump(struct stats *stats)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    uint64_t ticks = statsClock() - stats->startTicks;
+    double elapsed = (now.tv_sec - stats->start.tv_sec) * 1e9 + (now.tv_nsec - stats->start.tv_nsec);
+    double nsPerTick = ticks && elapsed > 0 ? elapsed / ticks : 1.0;
+
+    FILE *output = stats->file ? fopen(stats->file, "a") : stderr;
+    if (!output) {
+        LOG(LError, "Cannot open the statistics file '%s'", stats->file);
+        return;
+    }
+
+    pthread_mutex_lock(&stats->lock);
+    if (stats->format == StatsJson) {
+        fprintf(output, "{\"stages\":[");
+    } else {
+        fprintf(output, "stage module calls success done error unknown p50(ns) p99(ns) p999(ns) max(ns)"
+                        " batches batch-p50(ns) batch-p99(ns) batch-p999(ns) batch-max(ns)\n");
+    }
+
+    struct stageCounters sum;
+    for (int s = 0; s < stats->stageCount; ++s) {
+        collect(stats, s, &sum);
+        uint64_t calls = 0;
+        for (size_t c = 0; c < codeCount; ++c) {
+            calls += sum.codes[c];
+        }
+        const char *stage = s < stats->preSize ? "process" : "postProcess";
+        unsigned long long batches = samples(&sum.batch);
+
+        if (stats->format == StatsJson) {
+            fprintf(output,
+                    "%s{\"stage\":\"%s\",\"module\":\"%s\",\"calls\":%llu,"
+                    "\"codes\":{\"success\":%llu,\"done\":%llu,\"error\":%llu,\"unknown\":%llu},"
+                    "\"latencyNs\":",
+                    s ? "," : "", stage, stats->modules[s]->name, (unsigned long long)calls,
+                    (unsigned long long)sum.codes[2], (unsigned long long)sum.codes[1],
+                    (unsigned long long)sum.codes[0], (unsigned long long)sum.codes[3]);
+            dumpLatency(&sum.query, nsPerTick, 1, output);
+            fprintf(output, ",\"batches\":%llu,\"batchLatencyNs\":", batches);
+            dumpLatency(&sum.batch, nsPerTick, 1, output);
+            fprintf(output, "}");
+        } else {
+            fprintf(output, "%s %s %llu %llu %llu %llu %llu",
+                    stage, stats->modules[s]->name, (unsigned long long)calls,
+                    (unsigned long long)sum.codes[2], (unsigned long long)sum.codes[1],
+                    (unsigned long long)sum.codes[0], (unsigned long long)sum.codes[3]);
+            dumpLatency(&sum.query, nsPerTick, 0, output);
+            fprintf(output, " %llu", batches);
+            dumpLatency(&sum.batch, nsPerTick, 0, output);
+            fprintf(output, "\n");
+        }
+    }
+    pthread_mutex_unlock(&stats->lock);
+
+    if (stats->format == StatsJson) {
+        fprintf(output, "],\"modules\":{");
+    }
+    dumpModules(stats, output);
+    if (stats->format == StatsJson) {
+        fprintf(output, "}}\n");
+    }
+
+    if (output == stderr) {
+        fflush(output);
+    } else {
+        fclose(output);
+    }
+}
+
+void statsClose(struct stats *stats)
+{
+    if (!stats) {
+        return;
+    }
+
+    sigaction(SIGUSR1, &stats->previous, NULL);
+    while (stats->blocks) {
+        struct statsBlock *block = stats->blocks;
+        stats->blocks = block->next;
+        free(block);
+    }
+    if (threadOwner == stats) {
+        threadOwner = NULL;
+        threadBlock = NULL;
+    }
+
+    pthread_mutex_destroy(&stats->lock);
+    free(stats->modules);
+    free(stats->file);
+    free(stats);
+}
@@ -0,0 +1,108 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define STATS_TSC 1
+#else
+#include <time.h>
+#endif
+
+struct pipeline;
+struct batch;
+
+enum statsFormat {
+    StatsText,
+    StatsJson
+};
+
+struct statsSettings {
+    // Whether the statistics are collected.
+    int enabled;
+    // The file the statistics are appended to, NULL for the standard
+    // error output.
+    const char *file;
+    enum statsFormat format;
+};
+
+struct stats;
+
+/** Start collecting the statistics of the stages of the pipeline
+ *
+ *  Every process and postprocess stage gets call and response code
+ *  counters and two latency histograms, one for the calls for single
+ *  queries and one for the calls for whole batches. SIGUSR1 requests a dump, see
+ *  statsPoll.
+ *
+ *  @param pipeline The pipeline. Its stages are numbered in the order
+ *                  they run, the process stages first. The modules
+ *                  must live as long as the statistics.
+ *  @param settings The file and the format of the dumps.
+ *  @return the statistics or NULL in case the allocation fails
+ */
+struct stats *statsStart(const struct pipeline *pipeline, const struct statsSettings *settings);
+
+/** The current time in ticks of the statistics clock
+ *
+ *  The time stamp counter where there is one, nanoseconds otherwise.
+ */
+static inline uint64_t statsClock(void)
+{
+#ifdef STATS_TSC
+    return __rdtsc();
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + now.tv_nsec;
+#endif
+}
+
+/** Record one call of a stage for a single query
+ *
+ *  Takes no lock, every thread has its own counters.
+ *
+ *  @param stats The statistics.
+ *  @param stage The stage.
+ *  @param code The response code the call left.
+ *  @param ticks The duration of the call.
+ */
+void statsQuery(struct stats *stats, int stage, int code, uint64_t ticks);
+
+/** Record one call of a stage for a whole batch
+ *
+ *  The queries which took part are counted one by one. The duration
+ *  goes to the batch histogram, it says nothing about any one query.
+ *
+ *  @param stats The statistics.
+ *  @param stage The stage.
+ *  @param batch The batch after the call.
+ *  @param ticks The duration of the call.
+ */
+void statsBatch(struct stats *stats, int stage, const struct batch *batch, uint64_t ticks);
+
+/** Dump the statistics in case SIGUSR1 came since the last dump
+ *
+ *  @param stats The statistics.
+ */
+void statsPoll(struct stats *stats);
+
+/** Append the statistics of all threads to the file
+ *
+ *  Modules with a dump function add their own state, once per module.
+ *
+ *  @param stats The statistics.
+ */
+void statsDump(struct stats *stats);
+
+/** Release the statistics
+ *
+ *  The threads which recorded must not record any more.
+ *
+ *  @param stats The statistics.
+ */
+void statsClose(struct stats *stats);
+
+#endif
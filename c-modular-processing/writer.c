@@ -0,0 +1,158 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "writer.h"
+
+enum {
+    // Pieces passed to one writev, well below IOV_MAX.
+    chunkPieces = 64
+};
+
+struct writer {
+    int fd;
+    int ownsFd;
+
+    char *buffer;
+    size_t capacity;
+    size_t length;
+
+    // Set after a failed write, the rest of the output is dropped.
+    int failed;
+};
+
+struct writer *writerOpen(const char *file, size_t bufferSize)
+{
+    struct writer *writer = (struct writer *)calloc(1, sizeof(struct writer));
+    if (!writer) {
+        LOG(LFatal, "Allocation failed (%zu bytes)", sizeof(struct writer));
+        return NULL;
+    }
+
+    writer->fd = STDOUT_FILENO;
+    if (file) {
+        writer->fd = open(file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (writer->fd < 0) {
+            LOG(LError, "Cannot open output file '%s'", file);
+            free(writer);
+            return NULL;
+        }
+        writer->ownsFd = 1;
+    }
+
+    if (bufferSize) {
+        writer->buffer = (char *)malloc(bufferSize);
+        if (!writer->buffer) {
+            LOG(LFatal, "Allocation failed (%zu bytes)", bufferSize);
+            writerClose(writer);
+            return NULL;
+        }
+        writer->capacity = bufferSize;
+    }
+    return writer;
+}
+
+int writerInteractive(const struct writer *writer)
+{
+    return isatty(writer->fd);
+}
+
+// Partly written pieces are adjusted, so the pieces are changed.
+static int writeAll(struct writer *writer, struct iovec *pieces, size_t count)
+{
+    while (count) {
+        ssize_t written = writev(writer->fd, pieces, (int)count);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            LOG(LError, "Could not write the output");
+            writer->failed = 1;
+            return 1;
+        }
+        while (count && (size_t)written >= pieces->iov_len) {
+            written -= pieces->iov_len;
+            ++pieces;
+            --count;
+        }
+        if (count) {
+            pieces->iov_base = (char *)pieces->iov_base + written;
+            pieces->iov_len -= written;
+        }
+    }
+    return 0;
+}
+
+// Writes the buffer followed by the pieces.
+static int writeThrough(struct writer *writer, const struct iovec *pieces, size_t count)
+{
+    struct iovec chunk[chunkPieces];
+    size_t used = 0;
+    if (writer->length) {
+        chunk[used].iov_base = writer->buffer;
+        chunk[used].iov_len = writer->length;
+        ++used;
+        writer->length = 0;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        if (!pieces[i].iov_len) {
+            continue;
+        }
+        chunk[used++] = pieces[i];
+        if (used == chunkPieces) {
+            if (writeAll(writer, chunk, used)) {
+                return 1;
+            }
+            used = 0;
+        }
+    }
+    return used ? writeAll(writer, chunk, used) : 0;
+}
+
+int writerWrite(struct writer *writer, const struct iovec *pieces, size_t count, int flush)
+{
+    if (writer->failed) {
+        return 1;
+    }
+
+    size_t total = 0;
+    for (size_t i = 0; i < count; ++i) {
+        total += pieces[i].iov_len;
+    }
+    if (flush || total > writer->capacity - writer->length) {
+        return writeThrough(writer, pieces, count);
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        if (pieces[i].iov_len) {
+            memcpy(writer->buffer + writer->length, pieces[i].iov_base, pieces[i].iov_len);
+            writer->length += pieces[i].iov_len;
+        }
+    }
+    return 0;
+}
+
+int writerFlush(struct writer *writer)
+{
+    if (writer->failed) {
+        return 1;
+    }
+    return writeThrough(writer, NULL, 0);
+}
+
+void writerClose(struct writer *writer)
+{
+    if (!writer) {
+        return;
+    }
+    writerFlush(writer);
+    if (writer->ownsFd && close(writer->fd)) {
+        LOG(LError, "Could not write the output");
+    }
+    free(writer->buffer);
+    free(writer);
+}
@@ -0,0 +1,62 @@
+#ifndef WRITER_H
+#define WRITER_H
+
+#include <stddef.h>
+#include <sys/uio.h>
+
+enum writerFlush {
+    // Line buffered on a terminal, FlushExit otherwise.
+    FlushAuto,
+    FlushLine,
+    FlushBatch,
+    // Only when the buffer is full and at the end.
+    FlushExit
+};
+
+struct writer;
+
+/** Open the output
+ *
+ *  @param file The path to the output file, it is truncated,
+ *              or NULL for the standard output.
+ *  @param bufferSize The size of the buffer, 0 to write directly.
+ *  @return the writer or NULL in case the file cannot be opened
+ *          or the allocation fails
+ */
+struct writer *writerOpen(const char *file, size_t bufferSize);
+
+/** Check whether the output is a terminal
+ *
+ *  @param writer The writer.
+ */
+int writerInteractive(const struct writer *writer);
+
+/** Write a sequence of pieces
+ *
+ *  The pieces are copied into the buffer when they fit, otherwise they
+ *  are written together with the buffer by a single writev.
+ *
+ *  @param writer The writer.
+ *  @param pieces The pieces.
+ *  @param count The number of pieces.
+ *  @param flush Nonzero to write the buffer and the pieces right away.
+ *  @return 0 in case of success
+ *          1 in case the output cannot be written
+ */
+int writerWrite(struct writer *writer, const struct iovec *pieces, size_t count, int flush);
+
+/** Write the buffer out
+ *
+ *  @param writer The writer.
+ *  @return 0 in case of success
+ *          1 in case the output cannot be written
+ */
+int writerFlush(struct writer *writer);
+
+/** Flush the buffer and release all resources hold by the writer.
+ *
+ *  @param writer The writer, may be NULL.
+ */
+void writerClose(struct writer *writer);
+
+#endif